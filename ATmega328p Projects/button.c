@@ -0,0 +1,84 @@
+#include "button.h"
+
+static volatile button_event_t queue[BUTTON_QUEUE_SIZE]; // Circular buffer of button events
+static volatile uint8_t queueHead = 0; // Index to write the next event to (only changed by the ISR)
+static volatile uint8_t queueTail = 0; // Index to read the next event from (only changed by button_get_event)
+static volatile uint8_t droppedCount = 0; // Number of events lost because the queue was full
+
+static volatile uint8_t isArmed = 0; // 1 -> INT1 is enabled and waiting for a press
+static volatile uint8_t isReleased = 0; // 1 -> button has been seen released since the last press
+static uint16_t releaseTime; // Tick the button was first seen released
+
+// Handle interrupt
+// Only timestamps the edge and queues it, so this ISR takes a few microseconds no matter how often the button is pressed
+// INT1 stays disabled until button_update sees the button released for BUTTON_DEBOUNCE_TICKS, which ignores contact bounce
+ISR(INT1_vect)
+{
+	EIMSK &= ~(1 << INT1); // Disable INT1 until the button is debounced
+	isArmed = 0;
+	isReleased = 0;
+
+	uint8_t next = (queueHead + 1) & (BUTTON_QUEUE_SIZE - 1);
+	if (next == queueTail) // Queue is full, drop the event
+	{
+		droppedCount++;
+		return;
+	}
+	queue[queueHead].type = BUTTON_PRESS;
+	queue[queueHead].time = pattern_ticks();
+	queueHead = next;
+}
+
+// Initializes the button on INT1 (PD3) with its pull-up resistor, and arms the interrupt
+void button_init(void)
+{
+	DDRD &= ~(1 << DDD3); // Set DDD3/INT1 to input
+	PORTD |= (1 << PORTD3); // Set port D3 to high, and since DDD3/INT1 is set to input, the pull-up resistor is activated
+
+	EICRA = (1 << ISC11) | (0 << ISC10); // Set ISC11 to 1 and ISC10 to 0, this generates an interrupt request on the falling edge of INT1
+	EIFR = (1 << INTF1); // Clear any pending INT1 request
+	isArmed = 1;
+	EIMSK |= (1 << INT1); // Set INT1 to 1 in interrupt mask register (Enables interrupts on INT1)
+}
+
+// Re-arms INT1 once the button has been released for BUTTON_DEBOUNCE_TICKS; call this from the main loop
+void button_update(void)
+{
+	if (isArmed) return; // Nothing to debounce
+
+	uint16_t now = pattern_ticks();
+	if (PIND & (1 << PIND3)) // Button is released (pulled high)
+	{
+		if (!isReleased)
+		{
+			releaseTime = now;
+			isReleased = 1;
+		}
+		else if ((uint16_t) (now - releaseTime) >= BUTTON_DEBOUNCE_TICKS)
+		{
+			isArmed = 1;
+			EIFR = (1 << INTF1); // Clear edges latched while the button was bouncing
+			EIMSK |= (1 << INT1); // Enable INT1 again
+		}
+	}
+	else isReleased = 0; // Button is still pressed (or bouncing), restart the debounce time
+}
+
+// Gets the oldest event from the queue into event
+// Returns 1 if there was an event, 0 if the queue is empty
+uint8_t button_get_event(button_event_t *event)
+{
+	uint8_t tail = queueTail;
+	if (tail == queueHead) return 0;
+
+	event->type = queue[tail].type;
+	event->time = queue[tail].time;
+	queueTail = (tail + 1) & (BUTTON_QUEUE_SIZE - 1);
+	return 1;
+}
+
+// Returns the number of events dropped because the queue was full
+uint8_t button_dropped_count(void)
+{
+	return droppedCount;
+}
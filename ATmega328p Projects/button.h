@@ -0,0 +1,30 @@
+#ifndef BUTTON_H_
+#define BUTTON_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include "pattern.h"
+
+#define BUTTON_QUEUE_SIZE 8 // Number of events the queue can hold, must be a power of 2
+#define BUTTON_DEBOUNCE_TICKS PATTERN_MS(20) // Time the button must read released before INT1 is re-armed
+
+// Event types
+enum
+{
+	BUTTON_NONE,
+	BUTTON_PRESS
+};
+
+typedef struct button_event_t
+{
+	uint8_t type; // Type of event (BUTTON_PRESS)
+	uint16_t time; // Pattern engine tick the edge happened on (see pattern_ticks)
+} button_event_t;
+
+void button_init(void);
+void button_update(void);
+uint8_t button_get_event(button_event_t *event);
+uint8_t button_dropped_count(void);
+
+#endif /* BUTTON_H_ */
@@ -1,137 +1,105 @@
 #define F_CPU 16000000UL
 
 #include <avr/io.h>
-#include <util/delay.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "pattern.h"
+#include "button.h"
 
 #define delay 100 // The delay, in milliseconds, put between LED operations (i.e. the time duration one LED should be ON before it's turned OFF)
-#define numModes 2 // The number of modes for the LEDs to cycle through
+#define numModes 3 // The number of modes for the LEDs to cycle through
+#define maxBlinks 5 // The most blinks a button press plays, the count goes back to 1 after this
 
-void colorDot();
-void colorTrail();
-void colorBlink(int num);
+#define ON  PATTERN_ON
+#define OFF PATTERN_OFF
 
-// Used for the number of blinks when pressing the button
-// Needs to be volatile since this value is modified in an interrupt (the compiler shouldn't try to predict blinkCount by this assignment statement)
-volatile unsigned int blinkCount = 1;
+// LEDs are toggled in a line, only one LED is ON at a time
+static const keyframe_t colorDot[] PROGMEM =
+{
+	{{ON,  OFF, OFF, OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{OFF, ON,  OFF, OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{OFF, OFF, ON,  OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, ON,  OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, ON,  OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, ON,  OFF, OFF}, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, ON,  OFF}, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, OFF, ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF}, 0, 0},
+};
+
+// LEDs are toggled in a line, and stay ON until all LEDs are ON, and then all LEDs are turned off in a line
+static const keyframe_t colorTrail[] PROGMEM =
+{
+	{{ON,  OFF, OFF, OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{ON,  ON,  OFF, OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{ON,  ON,  ON,  OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{ON,  ON,  ON,  ON,  OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{ON,  ON,  ON,  ON,  ON,  OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+	{{ON,  ON,  ON,  ON,  ON,  ON,  OFF, OFF}, PATTERN_MS(delay), 0},
+	{{ON,  ON,  ON,  ON,  ON,  ON,  ON,  OFF}, PATTERN_MS(delay), 0},
+	{{ON,  ON,  ON,  ON,  ON,  ON,  ON,  ON }, PATTERN_MS(delay), 0},
+	{{OFF, ON,  ON,  ON,  ON,  ON,  ON,  ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, ON,  ON,  ON,  ON,  ON,  ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, ON,  ON,  ON,  ON,  ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, ON,  ON,  ON,  ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, ON,  ON,  ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, ON,  ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, OFF, ON }, PATTERN_MS(delay), 0},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(delay), 0},
+};
 
-// Handle interrupt
-ISR(INT1_vect) 
+// All LEDs fade ON, and then fade back OFF
+static const keyframe_t colorBreathe[] PROGMEM =
 {
-	colorBlink(blinkCount++);
-}
+	{{ON,  ON,  ON,  ON,  ON,  ON,  ON,  ON }, PATTERN_MS(8 * delay), 1},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(8 * delay), 1},
+};
+
+// LEDs are blinked ON/OFF once (played n times for n blinks)
+static const keyframe_t colorBlink[] PROGMEM =
+{
+	{{ON,  ON,  ON,  ON,  ON,  ON,  ON,  ON }, PATTERN_MS(500), 0},
+	{{OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF}, PATTERN_MS(500), 0},
+};
+
+#define numFrames(pattern) (sizeof(pattern) / sizeof(keyframe_t))
 
 int main(void)
 {
-	
-	DDRB = 0b00000111; // Set all LED ports using port B to output
-	DDRD = 0b11110100; // Set all LED ports using port D to output, interrupt INT1 to input, PD0 and PD1 are reserved for communication with host
-	
-	PORTD = (1 << PORTD3); // Set port D3 to high, and since DDD3/INT1 is set to input, the pull-up resistor is activated
-	
-	EICRA = (1 << ISC11) | (0 << ISC10); // Set ISC11 to 1 and ISC10 to 0, this generates an interrupt request on the falling edge of INT1
-	EIMSK = (1 << INT1); // Set INT1 to 1 in interrupt mask register (Enables interrupts on INT1)
-	
+	pattern_init(); // Set all LED ports to output, and start the Timer2 BAM driver
+	button_init(); // Set INT1 to input with pull-up, and enable its interrupt
+
 	sei(); // Global interrupt enable
-	
+
 	// counter used to switch between different modes (i.e. colorDot and colorTrial)
 	// an unsigned int allows counter to go back to 0 when it overflows (to avoid undefined behavior with signed int overflow)
 	unsigned int counter = 0;
-	
+	unsigned int blinkCount = 1; // Used for the number of blinks when pressing the button
+	button_event_t event;
+
 	while (1)
 	{
-		switch (counter % numModes) // Select what the LEDs do based on the counter
+		button_update(); // Re-arm the button once it is debounced
+		if (button_get_event(&event) && event.type == BUTTON_PRESS) // The button interrupts the current mode
+		{
+			pattern_play(colorBlink, numFrames(colorBlink), blinkCount);
+			blinkCount = (blinkCount % maxBlinks) + 1; // Keep the number of blinks bounded
+		}
+
+		if (pattern_update()) continue; // The current pattern is still playing
+
+		switch (counter % numModes) // Select what the LEDs do next based on the counter
 		{
 			case 0:
-				colorDot();
+				pattern_play(colorDot, numFrames(colorDot), 1);
 				break;
 			case 1:
-				colorTrail();
+				pattern_play(colorTrail, numFrames(colorTrail), 1);
+				break;
+			case 2:
+				pattern_play(colorBreathe, numFrames(colorBreathe), 1);
 				break;
 		}
 		counter++; // Increment counter to go to next mode
 	}
 }
-
-// sets the LEDNum light to state (zero is OFF, non-zero is ON)
-inline void set(unsigned int LEDNum, int state) 
-{
-	switch (LEDNum) 
-	{
-		case 0:
-			if (state) PORTB |= (1<<PORTB0);
-			else PORTB &= ~(1<<PORTB0);
-			break;
-		case 1:
-			if (state) PORTB |= (1<<PORTB1);
-			else PORTB &= ~(1<<PORTB1);
-			break;
-		case 2:
-			if (state) PORTD |= (1<<PORTD2);
-			else PORTD &= ~(1<<PORTD2);
-			break;
-		case 3:
-			if (state) PORTB |= (1<<PORTB2);
-			else PORTB &= ~(1<<PORTB2);
-			break;
-		case 4:
-			if (state) PORTD |= (1<<PORTD4);
-			else PORTD &= ~(1<<PORTD4);
-			break;
-		case 5:
-			if (state) PORTD |= (1<<PORTD5);
-			else PORTD &= ~(1<<PORTD5);
-			break;
-		case 6:
-			if (state) PORTD |= (1<<PORTD6);
-			else PORTD &= ~(1<<PORTD6);
-			break;
-		case 7:
-			if (state) PORTD |= (1<<PORTD7);
-			else PORTD &= ~(1<<PORTD7);
-			break;
-	}
-}
-
-// LEDs are toggled in a line, only one LED is ON at a time
-void colorDot() 
-{
-	for (int i = 0; i < 8; i++) 
-	{
-		set(i, 1); // Turn LED ON
-		_delay_ms(delay);
-		set(i, 0); // Turn LED OFF
-	}
-}
-
-// LEDs are toggled in a line, and stay ON until all LEDs are ON, and then all LEDs are turned off in a line
-void colorTrail() 
-{
-	for (int i = 0; i < 8; i++) 
-	{
-		set(i, 1);
-		_delay_ms(delay);
-	}
-	
-	for (int i = 0; i < 8; i++) 
-	{
-		set(i, 0);
-		_delay_ms(delay);
-	}
-}
-
-// LEDs are blinked ON/OFF n number of times
-void colorBlink(int n) 
-{
-	for (int i = 0; i < n; i++) 
-	{
-		// Turn all LEDs ON
-		for (int i = 0; i < 8; i++) set(i, 1);
-		_delay_ms(500);
-		
-		// Turn all LEDs OFF
-		for (int i = 0; i < 8; i++) set(i, 0);
-		_delay_ms(500);
-	}
-}
-
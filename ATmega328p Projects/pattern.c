@@ -0,0 +1,223 @@
+#include "pattern.h"
+#include <string.h>
+#include <util/atomic.h>
+
+#define LED_MASK_B ((1 << PORTB0) | (1 << PORTB1) | (1 << PORTB2)) // LED pins on port B
+#define LED_MASK_D ((1 << PORTD2) | (1 << PORTD4) | (1 << PORTD5) | (1 << PORTD6) | (1 << PORTD7)) // LED pins on port D
+
+// Port bit of each LED (LEDs 0-7 in the order they are wired on the board), an LED is either on port B or port D
+static const uint8_t ledMaskB[PATTERN_NUM_LEDS] PROGMEM = {(1 << PORTB0), (1 << PORTB1), 0, (1 << PORTB2), 0, 0, 0, 0};
+static const uint8_t ledMaskD[PATTERN_NUM_LEDS] PROGMEM = {0, 0, (1 << PORTD2), 0, (1 << PORTD4), (1 << PORTD5), (1 << PORTD6), (1 << PORTD7)};
+
+// Length of each BAM bit in Timer2 counts (bit n is shown for 2^n units), a table read takes the same time for every
+// bit, unlike 1 << bit which the AVR does with a loop
+static const uint8_t bamLength[8] PROGMEM = {1, 2, 4, 8, 16, 32, 64, 128};
+
+// Port values for each BAM bit, double buffered so a frame is never shown half updated
+// The ISR reads from bamFront, and pattern_commit fills the other buffer and requests a swap at the start of the next frame
+static volatile uint8_t bamPortB[2][8];
+static volatile uint8_t bamPortD[2][8];
+static volatile uint8_t bamFront = 0;
+static volatile uint8_t bamSwap = 0;
+static uint8_t bamBit = 7; // The BAM bit currently being shown (only used in the ISR)
+
+static volatile uint16_t ticks = 0; // Number of BAM frames shown since pattern_init, one tick per frame
+
+#ifdef PATTERN_PROFILE
+static volatile uint16_t isrMaxCycles = 0;
+#endif
+
+// Pattern state (only used outside of interrupts)
+static const keyframe_t *patternFrames; // Keyframe table of the playing pattern (in flash)
+static uint8_t patternCount; // Number of keyframes in patternFrames
+static uint8_t patternIndex; // Index of the current keyframe
+static uint16_t patternRepeat; // Number of times left to play the pattern, 0 -> loop forever
+static uint8_t isPlaying = 0;
+static keyframe_t current; // Copy of the current keyframe
+static uint16_t elapsed; // Ticks spent in the current keyframe
+static uint16_t lastTick; // Last tick handled by pattern_update
+static uint8_t startLevels[PATTERN_NUM_LEDS]; // Levels at the start of the current keyframe, used for fading
+static uint8_t levels[PATTERN_NUM_LEDS]; // Levels currently shown
+
+// Shows the next BAM bit; runs 8 times per frame, and always does the same amount of work, no matter the pattern
+// The compare register is advanced from its last value, so ISR latency doesn't stretch the bit lengths, as long as
+// it stays under one unit (16us); other ISRs in this project must be kept shorter than that
+// Bit 0 is the tight case: OCR2A has to be advanced before TCNT2 counts past it, 256 CPU cycles after the match
+// Cost (counted from the instructions at -Os, not yet confirmed with PATTERN_PROFILE on the board): ~75 cycles for
+// the body on a frame start with a swap, ~50 more for the interrupt response, vector jump, register saves and reti,
+// so ~125 of the 256 cycles; re-measure with pattern_isr_max_cycles after changing this ISR
+ISR(TIMER2_COMPA_vect)
+{
+#ifdef PATTERN_PROFILE
+	uint16_t start = TCNT1;
+#endif
+
+	uint8_t bit = (bamBit + 1) & 0x7; // Go to the next bit, wrapping back to bit 0 after bit 7
+	bamBit = bit;
+
+	if (bit == 0) // Start of a new frame
+	{
+		ticks++;
+		if (bamSwap) // Show the new levels, if pattern_commit prepared them
+		{
+			bamFront ^= 1;
+			bamSwap = 0;
+		}
+	}
+
+	uint8_t front = bamFront;
+	PORTB = (PORTB & ~LED_MASK_B) | bamPortB[front][bit];
+	PORTD = (PORTD & ~LED_MASK_D) | bamPortD[front][bit];
+	OCR2A += pgm_read_byte(&bamLength[bit]); // Schedule the end of this bit
+
+#ifdef PATTERN_PROFILE
+	uint16_t cycles = TCNT1 - start;
+	if (cycles > isrMaxCycles) isrMaxCycles = cycles;
+#endif
+}
+
+// Initializes LED pins, and starts Timer2 to drive the LEDs using bit angle modulation (BAM)
+void pattern_init(void)
+{
+	DDRB |= LED_MASK_B; // Set all LED ports using port B to output
+	DDRD |= LED_MASK_D; // Set all LED ports using port D to output
+
+	TCCR2A = 0; // Normal mode, OC2A and OC2B disconnected (the compare register is advanced in the ISR)
+	TCCR2B = (1 << CS22) | (1 << CS21); // Prescaler 256 (16us per count at 16MHz)
+	OCR2A = TCNT2 + 1;
+	TIMSK2 = (1 << OCIE2A); // Enable Timer2 compare match A interrupt
+
+#ifdef PATTERN_PROFILE
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10); // Timer1 counts CPU cycles (no prescaler)
+#endif
+}
+
+// Converts levels into port values for each BAM bit, and shows them from the start of the next frame
+static void pattern_commit(void)
+{
+	while (bamSwap); // Wait for the ISR to pick up the previous levels (at most one frame)
+
+	uint8_t back = bamFront ^ 1;
+	for (uint8_t bit = 0; bit < 8; bit++)
+	{
+		uint8_t mask = (1 << bit);
+		uint8_t portB = 0;
+		uint8_t portD = 0;
+		for (uint8_t led = 0; led < PATTERN_NUM_LEDS; led++)
+		{
+			if (levels[led] & mask)
+			{
+				portB |= pgm_read_byte(&ledMaskB[led]);
+				portD |= pgm_read_byte(&ledMaskD[led]);
+			}
+		}
+		bamPortB[back][bit] = portB;
+		bamPortD[back][bit] = portD;
+	}
+	bamSwap = 1;
+}
+
+// Sets the brightness of every LED (0 -> OFF, 255 -> fully ON)
+void pattern_set_levels(const uint8_t newLevels[])
+{
+	memcpy(levels, newLevels, PATTERN_NUM_LEDS);
+	pattern_commit();
+}
+
+// Returns the number of ticks (BAM frames) since pattern_init
+uint16_t pattern_ticks(void)
+{
+	uint16_t t;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) t = ticks; // ticks is 2 bytes, so make sure the ISR doesn't change it mid read
+	return t;
+}
+
+// Returns the longest time spent in the Timer2 ISR body in CPU cycles (excluding the ~50 cycles of interrupt response, register saves and reti)
+// Only measured when PATTERN_PROFILE is defined, otherwise returns 0
+uint16_t pattern_isr_max_cycles(void)
+{
+	uint16_t cycles = 0;
+#ifdef PATTERN_PROFILE
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) cycles = isrMaxCycles;
+#endif
+	return cycles;
+}
+
+// Copies keyframe index from flash, and starts it from the current levels
+static void load_keyframe(uint8_t index)
+{
+	patternIndex = index;
+	memcpy_P(&current, &patternFrames[index], sizeof(keyframe_t));
+	memcpy(startLevels, levels, PATTERN_NUM_LEDS);
+	elapsed = 0;
+	if (!current.fade) memcpy(levels, current.levels, PATTERN_NUM_LEDS); // Jump straight to the keyframe levels
+}
+
+// Starts playing count keyframes from frames (a table in flash), repeat number of times (0 -> loop forever)
+void pattern_play(const keyframe_t *frames, uint8_t count, uint16_t repeat)
+{
+	if (count == 0) return;
+
+	patternFrames = frames;
+	patternCount = count;
+	patternRepeat = repeat;
+	lastTick = pattern_ticks();
+	isPlaying = 1;
+
+	load_keyframe(0);
+	pattern_commit();
+}
+
+// Stops the playing pattern, LEDs keep their current levels
+void pattern_stop(void)
+{
+	isPlaying = 0;
+}
+
+// Advances the playing pattern by the ticks that passed since the last call; call this from the main loop
+// Returns 1 if a pattern is still playing, 0 if the pattern is finished (or nothing is playing)
+uint8_t pattern_update(void)
+{
+	if (!isPlaying) return 0;
+
+	uint16_t now = pattern_ticks();
+	uint8_t isChanged = 0;
+
+	while (isPlaying && lastTick != now)
+	{
+		lastTick++;
+		elapsed++;
+
+		if (current.fade) // Move every LED towards its target level
+		{
+			uint16_t duration = current.duration ? current.duration : 1;
+			uint16_t step = (elapsed < duration) ? elapsed : duration;
+			for (uint8_t led = 0; led < PATTERN_NUM_LEDS; led++)
+			{
+				int16_t delta = (int16_t) current.levels[led] - startLevels[led];
+				levels[led] = startLevels[led] + (int16_t) (((int32_t) delta * step) / duration);
+			}
+			isChanged = 1;
+		}
+
+		if (elapsed >= current.duration) // Keyframe is done, go to the next one
+		{
+			uint8_t next = patternIndex + 1;
+			if (next >= patternCount) // End of the pattern
+			{
+				next = 0;
+				if (patternRepeat != 0 && --patternRepeat == 0)
+				{
+					isPlaying = 0;
+					break;
+				}
+			}
+			load_keyframe(next);
+			isChanged = 1;
+		}
+	}
+
+	if (isChanged) pattern_commit();
+	return isPlaying;
+}
@@ -0,0 +1,41 @@
+#ifndef PATTERN_H_
+#define PATTERN_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+
+#define PATTERN_NUM_LEDS 8 // The number of LEDs driven by the pattern engine
+
+// Timer2 runs at F_CPU/256, so one BAM unit is 16us. A BAM frame shows bit n of every brightness level for 2^n units,
+// so a full 8-bit frame is 1+2+...+128 = 255 units (4.08ms, ~245Hz refresh). One frame is one pattern engine tick.
+#define PATTERN_UNIT_US  16
+#define PATTERN_FRAME_US (255UL * PATTERN_UNIT_US)
+
+// Converts a duration in milliseconds to pattern engine ticks (rounded to the nearest tick)
+#define PATTERN_MS(ms) ((uint16_t)((((ms) * 1000UL) + (PATTERN_FRAME_US / 2)) / PATTERN_FRAME_US))
+
+#define PATTERN_OFF 0   // Brightness level of an LED that is OFF
+#define PATTERN_ON  255 // Brightness level of an LED that is fully ON
+
+// Uncomment to measure the cost of the Timer2 ISR with Timer1 as a cycle counter (see pattern_isr_max_cycles)
+// #define PATTERN_PROFILE
+
+// One step of a pattern; keyframe tables are meant to be stored in flash (PROGMEM)
+typedef struct keyframe_t
+{
+	uint8_t levels[PATTERN_NUM_LEDS]; // Brightness of each LED at the end of this keyframe (0 -> OFF, 255 -> fully ON)
+	uint16_t duration; // Length of this keyframe in ticks (use PATTERN_MS)
+	uint8_t fade; // 1 -> fade linearly from the previous levels over duration; 0 -> jump to levels and hold them
+} keyframe_t;
+
+void pattern_init(void);
+void pattern_play(const keyframe_t *frames, uint8_t count, uint16_t repeat);
+void pattern_stop(void);
+uint8_t pattern_update(void);
+void pattern_set_levels(const uint8_t levels[]);
+uint16_t pattern_ticks(void);
+uint16_t pattern_isr_max_cycles(void);
+
+#endif /* PATTERN_H_ */
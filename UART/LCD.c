@@ -1,29 +1,126 @@
 
 #include "LCD.h"
+#include "lcd_bus.h"
 #include "twi_hal.h"
+#include "trace.h"
 #include <util/delay.h>
 
-// Sends data via TWI
-static uint8_t send_twi(LCD_t *lcd, uint8_t data)
+// Instruction execution times, worst case: the HD44780U datasheet gives 37us/41us/1.52ms at a typical 270kHz clock, but
+// the clock can be as slow as 190kHz, which stretches them by 270/190 (the 74HC595 bus can't poll the busy flag to find out)
+#define LCD_EXEC_US       55   // Most instructions (~53us at 190kHz)
+#define LCD_WRITE_EXEC_US 60   // Writing data to CGRAM/DDRAM, 4us longer to update the address counter (~58us at 190kHz)
+#define LCD_LONG_EXEC_US  2200 // Clear display and return home (~2.16ms at 190kHz)
+
+// Waits until an instruction that takes us has finished, after its second nibble was sent
+// The next byte's first bus write (Enable high) takes at least LCD_BUS_WRITE_US, so only the rest of us is waited here;
+// with the I2C backpack a write takes longer than any short instruction, so there is no wait at all
+#define WAIT_EXEC(us) do { if ((us) > LCD_BUS_WRITE_US) _delay_us((us) - LCD_BUS_WRITE_US); } while (0)
+
+// Sets the LCD's lines to data through the selected backend (see lcd_bus.h)
+static inline uint8_t send_bus(LCD_t *lcd, uint8_t data)
 {
-	return twi_write(lcd->addr, data | (lcd->isBacklightOn << BACKLIGHT));
+	return lcd_bus_write(lcd, data);
 }
 
 // Sends Enable pulse
 static uint8_t send_enable(LCD_t *lcd, uint8_t data)
 {
-	uint8_t err = send_twi(lcd, data | (1 << E)); // Send Enable high
+	uint8_t err = send_bus(lcd, data | (1 << E)); // Send Enable high
 	_delay_us(1); // Enable pulse needs to be high for at least 230ns
 	if (err != TWI_OK) return err;
 	
-	err = send_twi(lcd, data & ~(1 << E)); // Send Enable low
-	_delay_us(50); // Commands need a minimum of 37us to settle
+	err = send_bus(lcd, data & ~(1 << E)); // Send Enable low
+	_delay_us(1); // Enable cycle time is at least 500ns, the second nibble of a byte can follow right after
+	return err;
+}
+
+#if LCD_BUS_CAN_READ
+// Reads one nibble from the LCD with an Enable pulse (R/W must already be high), the nibble is in the high 4 bits of *data
+static uint8_t read_nibble(LCD_t *lcd, uint8_t mode, uint8_t *data)
+{
+	uint8_t err = send_bus(lcd, mode | (1 << E)); // Send Enable high, the LCD puts the nibble on DB4-DB7
+	_delay_us(1); // Data is valid 160ns after Enable goes high
+	if (err == TWI_OK) err = lcd_bus_read(lcd, data); // Read the pins
+	uint8_t endErr = send_bus(lcd, mode); // Send Enable low
+	return (err != TWI_OK) ? err : endErr;
+}
+
+// Reads the busy flag (bit 7) and the address counter (bits 0-6) into *data
+// The PCF8574 pins are quasi-bidirectional, so DB4-DB7 are written high before the LCD drives them
+static uint8_t read_busy_address(LCD_t *lcd, uint8_t *data)
+{
+	uint8_t mode = 0xF0 | (1 << RW); // Data pins released, RS low (instruction register), R/W high (read)
+	uint8_t high, low;
+	
+	uint8_t err = send_bus(lcd, mode);
+	if (err == TWI_OK) err = read_nibble(lcd, mode, &high);
+	if (err == TWI_OK) err = read_nibble(lcd, mode, &low);
+	send_bus(lcd, 0); // R/W back low, for writing
+	
+	*data = (high & 0xF0) | (low >> 4);
+	return err;
+}
+#endif
+
+// Runs the HD44780U initialization by instruction for 4 bit mode, for an LCD that has just been powered on
+static void init_cold(LCD_t *lcd)
+{
+	// Go through initialization instructions for LCD (from data sheet)
+	_delay_ms(20); // Wait more than 15ms after Vcc rises to 4.5V
+	send_bus(lcd, 0); // Pull RS and R/W low to begin sending commands
+	send_enable(lcd, 0b0011 << 4); // Special function set
+	_delay_ms(5); // Wait for more than 4.1ms
+	send_enable(lcd, 0b0011 << 4); // Special function set
+	_delay_us(200); // Wait for more than 100us
+	send_enable(lcd, 0b0011 << 4); // Special function set
+	_delay_us(200); // Wait for more than 100us
+	send_enable(lcd, 0b0010 << 4); // Initial function set to 4 bit
+	_delay_us(200); // Wait for more than 100us
+	// Now in 4-bit mode, can send 'regular' 4 bit commands
+	LCD_function_set(lcd, 0, 1, 0); // Regular function set
+	LCD_display_toggle(lcd, 0, 0, 0); // Display OFF (D=0, C=0, B=0)
+	LCD_clear_display(lcd); // Clear display
+	LCD_entry_mode_set(lcd, 1, 0); // Entry mode set (I/D=1 , S=0)
+	// End of Initialization
+}
+
+// Brings an LCD that stayed powered through the reset back to a known state, without the power-on waits
+// The reset may have happened between the two nibbles of a byte, so the special function sets are still sent to get back in step
+// (the LCD takes them whether it's in 4 bit or 8 bit mode), but only need the normal instruction time
+// Returns TWI_OK if the LCD answered a busy flag/address read afterwards, so it really is there and in 4 bit mode
+static uint8_t init_warm(LCD_t *lcd)
+{
+	uint8_t err = send_bus(lcd, 0); // Pull RS and R/W low to begin sending commands
+	if (err != TWI_OK) return err; // Nothing on the bus at lcd->addr
+	send_enable(lcd, 0b0011 << 4); // Special function set
+	WAIT_EXEC(LCD_EXEC_US);
+	send_enable(lcd, 0b0011 << 4); // Special function set
+	WAIT_EXEC(LCD_EXEC_US);
+	send_enable(lcd, 0b0011 << 4); // Special function set
+	WAIT_EXEC(LCD_EXEC_US);
+	send_enable(lcd, 0b0010 << 4); // Initial function set to 4 bit
+	WAIT_EXEC(LCD_EXEC_US);
+	LCD_function_set(lcd, 0, 1, 0); // Regular function set
+	LCD_display_toggle(lcd, 0, 0, 0); // Display OFF (D=0, C=0, B=0)
+	LCD_clear_display(lcd); // Clear display
+	LCD_entry_mode_set(lcd, 1, 0); // Entry mode set (I/D=1 , S=0)
+	
+#if LCD_BUS_CAN_READ
+	// After clear display and entry mode set, the LCD is idle with the address counter at 0
+	uint8_t busyAddress;
+	err = read_busy_address(lcd, &busyAddress);
+	if (err == TWI_OK && busyAddress != 0) err = TWI_ERROR_DATA_R;
+#endif
 	return err;
 }
 
 // Initializes LCD and runs through HD44780U Initialization process for 4 bit mode
 // Intializes cursor ON and cursor blink ON
-LCD_t LCD_init(uint8_t addr, uint8_t rows, uint8_t cols, uint32_t bus_speed, uint8_t isPCF8574A)
+// The bus must be initialized first (lcd_bus_init)
+// isWarmStart: 1 -> the LCD stayed powered through the reset (watchdog or reset pin, see MCUSR), so the ~30ms power-on sequence is skipped,
+//              falling back to it if the LCD doesn't answer (only checked if LCD_BUS_CAN_READ); 0 -> run the full power-on sequence
+// addr and isPCF8574A are only used by the PCF8574 backend
+LCD_t LCD_init(uint8_t addr, uint8_t rows, uint8_t cols, uint8_t isPCF8574A, uint8_t isWarmStart)
 {
 	// Initiate LCD struct
 	LCD_t lcd;
@@ -38,26 +135,7 @@ LCD_t LCD_init(uint8_t addr, uint8_t rows, uint8_t cols, uint32_t bus_speed, uin
 	if (isPCF8574A) lcd.addr |= (PCF8574A_FIXED_ADDR << 3);
 	else lcd.addr |= (PCF8574_FIXED_ADDR << 3);
 	
-	// Initiate TWI(I2C) communication
-	twi_init(bus_speed);
-	
-	// Go through initialization instructions for LCD (from data sheet)
-	_delay_ms(20); // Wait more than 15ms after Vcc rises to 4.5V
-	send_twi(&lcd, 0); // Pull RS and R/W low to begin sending commands
-	send_enable(&lcd, 0b0011 << 4); // Special function set
-	_delay_ms(5); // Wait for more than 4.1ms
-	send_enable(&lcd, 0b0011 << 4); // Special function set
-	_delay_us(200); // Wait for more than 100us
-	send_enable(&lcd, 0b0011 << 4); // Special function set
-	_delay_us(200); // Wait for more than 100us
-	send_enable(&lcd, 0b0010 << 4); // Initial function set to 4 bit
-	_delay_us(200); // Wait for more than 100us
-	// Now in 4-bit mode, can send 'regular' 4 bit commands
-	LCD_function_set(&lcd, 0, 1, 0); // Regular function set
-	LCD_display_toggle(&lcd, 0, 0, 0); // Display OFF (D=0, C=0, B=0)
-	LCD_clear_display(&lcd); // Clear display
-	LCD_entry_mode_set(&lcd, 1, 0); // Entry mode set (I/D=1 , S=0)
-	// End of Initialization
+	if (!isWarmStart || init_warm(&lcd) != TWI_OK) init_cold(&lcd);
 	
 	// Display ON
 	LCD_display_toggle(&lcd, 1, 1, 0);
@@ -65,29 +143,49 @@ LCD_t LCD_init(uint8_t addr, uint8_t rows, uint8_t cols, uint32_t bus_speed, uin
 	return lcd;
 }
 
-// Sends a byte via TWI
+// Sends a byte as two nibbles
 static uint8_t send_byte(LCD_t *lcd, uint8_t data, uint8_t mode)
 {
 	mode &= 0xF; // ignore most significant byte of mode
+	TRACE((mode & (1 << RS)) ? TRACE_LCD_DATA : TRACE_LCD_CMD, data);
 	
 	// Determine MS Nibble and LS Nibble
 	uint8_t MSNibble = (data & 0xF0) | mode;
 	uint8_t LSNibble = ((data << 4) & 0xF0) | mode;
 	
 	uint8_t err = send_enable(lcd, MSNibble); // Enable pulse
-	if (err != TWI_OK) return err;
+	if (err == TWI_OK) err = send_enable(lcd, LSNibble); // Enable pulse
 	
-	err = send_enable(lcd, LSNibble); // Enable pulse
+	// The LCD runs the instruction after the second nibble
+	if (mode & (1 << RS)) WAIT_EXEC(LCD_WRITE_EXEC_US);
+	else WAIT_EXEC(LCD_EXEC_US);
+	
+	TRACE(TRACE_LCD_END, err);
 	return err;
 }
 
+// Waits for a long instruction (clear display, return home) to finish
+// If the bus can read the LCD, the busy flag is polled, so this adapts to the LCD's actual speed; a failed read falls back to the worst case time
+static void wait_long(LCD_t *lcd)
+{
+#if LCD_BUS_CAN_READ
+	uint8_t busyAddress;
+	for (uint8_t i = 0; i < 10; i++) // Each read takes a few bus transfers (~1.5ms on I2C), so the LCD is usually done by the first one
+	{
+		if (read_busy_address(lcd, &busyAddress) != TWI_OK) break;
+		if (!(busyAddress & 0x80)) return; // Busy flag is clear
+	}
+#endif
+	_delay_us(LCD_LONG_EXEC_US);
+}
+
 // Clears all display data, returns cursor to original status (brings cursor to left edge on first line of display, text goes from left->right)
 uint8_t LCD_clear_display(LCD_t *lcd)
 {
 	uint8_t err = send_byte(lcd, 0b00000001, 0);
 	lcd->currRow = 0;
 	lcd->currCol = 0;
-	_delay_ms(3);
+	wait_long(lcd);
 	return err;
 }
 
@@ -97,7 +195,7 @@ uint8_t LCD_return_home(LCD_t *lcd)
 	uint8_t err = send_byte(lcd, 0b00000010, 0);
 	lcd->currRow = 0;
 	lcd->currCol = 0;
-	_delay_ms(3);
+	wait_long(lcd);
 	return err;
 }
 
@@ -108,7 +206,6 @@ uint8_t LCD_entry_mode_set(LCD_t *lcd, uint8_t isLtR, uint8_t isShift)
 {
 	uint8_t code = 0b00000100 | ((isLtR & 0x1) << 1) | ((isShift & 0x1) << 0);
 	uint8_t err = send_byte(lcd, code, 0);
-	_delay_us(50);
 	return err;
 }
 
@@ -120,7 +217,6 @@ uint8_t LCD_display_toggle(LCD_t *lcd, uint8_t isDisplayOn, uint8_t isCursorOn,
 {
 	uint8_t code = 0b00001000 | ((isDisplayOn & 0x1) << 2) | ((isCursorOn & 0x1) << 1) | ((isCursorBlink & 0x1) << 0);
 	uint8_t err = send_byte(lcd, code, 0);
-	_delay_us(50);
 	return err;
 }
 
@@ -131,7 +227,6 @@ uint8_t LCD_cursor_display_shift(LCD_t *lcd, uint8_t isDisplayShift, uint8_t isL
 {
 	uint8_t code = 0b00010000 | ((isDisplayShift & 0x1) << 3) | ((isLtR & 0x1) << 2);
 	uint8_t err = send_byte(lcd, code, 0);
-	_delay_us(50);
 	return err;
 }
 
@@ -143,7 +238,6 @@ uint8_t LCD_function_set(LCD_t *lcd, uint8_t dataLength, uint8_t numLines, uint8
 {
 	uint8_t code = 0b00100000 | ((dataLength & 0x1) << 4) | ((numLines & 0x1) << 3) | ((font & 0x1) << 2);
 	uint8_t err = send_byte(lcd, code, 0);
-	_delay_us(50);
 	return err;
 }
 
@@ -153,7 +247,6 @@ uint8_t LCD_set_CGRAM(LCD_t *lcd, uint8_t addr)
 	addr &= 0x3F; // CGRAM address takes lower 6 bits
 	uint8_t code = 0b01000000 | addr;
 	uint8_t err = send_byte(lcd, code, 0);
-	_delay_us(50);
 	return err;
 }
 
@@ -163,7 +256,6 @@ uint8_t LCD_set_DDRAM(LCD_t *lcd, uint8_t addr)
 	addr &= 0x7F; // DDRAM address takes lower 7 bits
 	uint8_t code = 0b10000000 | addr;
 	uint8_t err = send_byte(lcd, code, 0);
-	_delay_us(50);
 	return err;
 }
 
@@ -172,7 +264,6 @@ uint8_t LCD_write_data(LCD_t *lcd, uint8_t data)
 {;
 	uint8_t err = send_byte(lcd, data, (1 << RS));
 	lcd->currCol++;
-	_delay_us(100);
 	return err;
 }
 
@@ -192,13 +283,28 @@ uint8_t LCD_write_string(LCD_t *lcd, char *str)
 	return TWI_OK;
 }
 
+// Writes a string stored in flash (PROGMEM, e.g. PSTR("...")) to the LCD screen, without copying it to SRAM
+uint8_t LCD_write_string_P(LCD_t *lcd, const char *str)
+{
+	char letter;
+	while ((letter = pgm_read_byte(str++)) != 0x0)
+	{
+		uint8_t err = LCD_write_data(lcd, letter);
+		if (err != TWI_OK) return err;
+	}
+	return TWI_OK;
+}
+
 // Toggles backlight ON (1) or OFF (0)
 uint8_t LCD_toggle_backlight(LCD_t *lcd, uint8_t on)
 {
 	lcd->isBacklightOn = (on & 0x1);
-	return send_twi(lcd, 0); // send_twi sets backlight based on lcd's isBacklightOn
+	return send_bus(lcd, 0); // the backend sets backlight based on lcd's isBacklightOn
 }
 
+// DDRAM address of the first column of each row
+static const uint8_t rowOffsets[] PROGMEM = {0x0, 0x40};
+
 // Sets the cursor to the specified row and column
 uint8_t LCD_set_cursor(LCD_t *lcd, uint8_t row, uint8_t col)
 {
@@ -206,10 +312,9 @@ uint8_t LCD_set_cursor(LCD_t *lcd, uint8_t row, uint8_t col)
 	if ((lcd->rows <= row) | (lcd->cols <= col)) return -1;
 	
 	// Set DDRAM
-	uint8_t rowOffsets[] = {0x0, 0x40};
 	lcd->currRow = row;
 	lcd->currCol = col;
-	return LCD_set_DDRAM(lcd, rowOffsets[row] + col);
+	return LCD_set_DDRAM(lcd, pgm_read_byte(&rowOffsets[row]) + col);
 }
 
 // Adds a character defined by charMap (a custom character) to be added to CGRAM at the location specified
@@ -222,3 +327,14 @@ uint8_t LCD_add_character(LCD_t *lcd, uint8_t location, uint8_t charMap[])
 	err = LCD_set_cursor(lcd, 0, 0); // Set DDRAM (by setting cursor to (0,0)) to go back to using DDRAM
 	return err;
 }
+
+// Adds a custom character whose charMap (8 bytes) is stored in flash (PROGMEM), see LCD_add_character
+uint8_t LCD_add_character_P(LCD_t *lcd, uint8_t location, const uint8_t *charMap)
+{
+	location &= 0b111;
+	uint8_t err = LCD_set_CGRAM(lcd, location << 3); // Set CGRAM address
+	if (err != TWI_OK) return err;
+	for (int i = 0; i < 8; i++) LCD_write_data(lcd, pgm_read_byte(&charMap[i])); // Write character map to CGRAM address
+	err = LCD_set_cursor(lcd, 0, 0); // Set DDRAM (by setting cursor to (0,0)) to go back to using DDRAM
+	return err;
+}
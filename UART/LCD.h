@@ -1,5 +1,6 @@
 
 #include <stdint.h>
+#include <avr/pgmspace.h>
 
 #ifndef LCD_H_
 #define LCD_H_
@@ -26,7 +27,7 @@ typedef struct LCD_t
 	uint8_t isBacklightOn;
 } LCD_t;
 
-LCD_t LCD_init(uint8_t addr, uint8_t rows, uint8_t cols, uint32_t bus_speed, uint8_t isPCF8574A);
+LCD_t LCD_init(uint8_t addr, uint8_t rows, uint8_t cols, uint8_t isPCF8574A, uint8_t isWarmStart);
 
 uint8_t LCD_clear_display(LCD_t *lcd);
 uint8_t LCD_return_home(LCD_t *lcd);
@@ -39,8 +40,10 @@ uint8_t LCD_set_DDRAM(LCD_t *lcd, uint8_t addr);
 uint8_t LCD_write_data(LCD_t *lcd, uint8_t data);
 
 uint8_t LCD_write_string(LCD_t *lcd, char *str);
+uint8_t LCD_write_string_P(LCD_t *lcd, const char *str);
 uint8_t LCD_toggle_backlight(LCD_t *lcd, uint8_t on);
 uint8_t LCD_set_cursor(LCD_t *lcd, uint8_t row, uint8_t col);
 uint8_t LCD_add_character(LCD_t *lcd, uint8_t location, uint8_t charMap[]);
+uint8_t LCD_add_character_P(LCD_t *lcd, uint8_t location, const uint8_t *charMap);
 
 #endif /* LCD_H_ */
\ No newline at end of file
@@ -0,0 +1,444 @@
+#include "bigint.h"
+#include "calculator.h"
+#include <string.h>
+#include <avr/pgmspace.h>
+
+// Arbitrary-precision evaluator, used when an expression overflows int64_t
+// Numbers are magnitudes stored as bytes (limbs), least significant first, which suits the 8-bit ALU: the 8x8 -> 16 bit MUL
+// instruction does the work of a multiplication, and carries fit in a byte
+//
+// bigEval runs after the native evaluation has finished, so it uses operandStack as its arena (no extra SRAM)
+// The arena is a stack of numbers, each stored as [limbs...][length][sign], so the top two numbers are always the operands
+// of the next operator; results are built in the free space above them and then moved down in their place
+#define ARENA ((uint8_t *) operandStack)
+#define ARENA_SIZE sizeof(operandStack)
+
+static uint16_t top; // Index of the first free byte in the arena
+static uint8_t numCount; // Number of numbers on the arena stack
+static uint8_t isError; // Set when a number gets too large, or the expression can't be evaluated
+
+// Returns the length of a without leading zero limbs
+static uint8_t mag_normalize(const uint8_t *a, uint8_t len)
+{
+	while (len > 0 && a[len - 1] == 0) len--;
+	return len;
+}
+
+// Compares magnitudes a and b (normalized), returns 1 if a > b, -1 if a < b and 0 if they're equal
+static int8_t mag_cmp(const uint8_t *a, uint8_t la, const uint8_t *b, uint8_t lb)
+{
+	if (la != lb) return (la > lb) ? 1 : -1;
+	while (la-- > 0)
+	{
+		if (a[la] != b[la]) return (a[la] > b[la]) ? 1 : -1;
+	}
+	return 0;
+}
+
+// r = a + b, returns the length of r
+static uint8_t mag_add(uint8_t *r, const uint8_t *a, uint8_t la, const uint8_t *b, uint8_t lb)
+{
+	if (la < lb) // Make a the longer number
+	{
+		const uint8_t *t = a; a = b; b = t;
+		uint8_t lt = la; la = lb; lb = lt;
+	}
+
+	uint8_t carry = 0;
+	for (uint8_t i = 0; i < la; i++)
+	{
+		uint16_t sum = a[i] + (i < lb ? b[i] : 0) + carry;
+		r[i] = sum;
+		carry = sum >> 8;
+	}
+	r[la] = carry;
+	return mag_normalize(r, la + 1);
+}
+
+// r = a - b where a >= b, returns the length of r (r may be a)
+static uint8_t mag_sub(uint8_t *r, const uint8_t *a, uint8_t la, const uint8_t *b, uint8_t lb)
+{
+	uint8_t borrow = 0;
+	for (uint8_t i = 0; i < la; i++)
+	{
+		int16_t diff = a[i] - (i < lb ? b[i] : 0) - borrow;
+		r[i] = diff;
+		borrow = (diff < 0);
+	}
+	return mag_normalize(r, la);
+}
+
+// r = a * b, returns the length of r (r must have room for la + lb bytes)
+static uint8_t mag_mul(uint8_t *r, const uint8_t *a, uint8_t la, const uint8_t *b, uint8_t lb)
+{
+	memset(r, 0, la + lb);
+	for (uint8_t i = 0; i < la; i++)
+	{
+		uint8_t carry = 0;
+		for (uint8_t j = 0; j < lb; j++)
+		{
+			uint16_t t = (uint16_t) a[i] * b[j] + r[i + j] + carry; // At most 255 * 255 + 255 + 255, fits in 16 bits
+			r[i + j] = t;
+			carry = t >> 8;
+		}
+		r[i + lb] = carry;
+	}
+	return mag_normalize(r, la + lb);
+}
+
+// a = a * m + add in place, returns the length of a (a must have room for 2 more bytes)
+static uint8_t mag_mul_small(uint8_t *a, uint8_t la, uint16_t m, uint16_t add)
+{
+	uint32_t carry = add;
+	for (uint8_t i = 0; i < la; i++)
+	{
+		carry += (uint32_t) a[i] * m;
+		a[i] = carry;
+		carry >>= 8;
+	}
+	a[la] = carry;
+	a[la + 1] = carry >> 8;
+	return mag_normalize(a, la + 2);
+}
+
+// a = a / d in place, returns the remainder and sets *la to the new length of a
+static uint16_t mag_div_small(uint8_t *a, uint8_t *la, uint16_t d)
+{
+	uint16_t rem = 0;
+	if (d <= 0xFF) // Byte divisor, 16 bit by 8 bit steps
+	{
+		for (uint8_t i = *la; i-- > 0;)
+		{
+			uint16_t cur = (rem << 8) | a[i];
+			a[i] = cur / d;
+			rem = cur % d;
+		}
+	}
+	else
+	{
+		for (uint8_t i = *la; i-- > 0;)
+		{
+			uint32_t cur = ((uint32_t) rem << 8) | a[i];
+			a[i] = cur / d;
+			rem = cur % d;
+		}
+	}
+	*la = mag_normalize(a, *la);
+	return rem;
+}
+
+// q = a / b and r = a % b (b non-zero), sets *lq and *lr to their lengths
+// q must have room for la bytes and r for lb + 1 bytes
+static void mag_divmod(uint8_t *q, uint8_t *lq, uint8_t *r, uint8_t *lr, const uint8_t *a, uint8_t la, const uint8_t *b, uint8_t lb)
+{
+	if (lb <= 2) // Small divisor, divide a limb at a time
+	{
+		memcpy(q, a, la);
+		*lq = la;
+		uint16_t rem = mag_div_small(q, lq, b[0] | (lb == 2 ? b[1] << 8 : 0));
+		r[0] = rem;
+		r[1] = rem >> 8;
+		*lr = mag_normalize(r, 2);
+		return;
+	}
+
+	// Shift and subtract, one bit of a at a time; r only ever holds up to lb + 1 bytes
+	memset(q, 0, la);
+	memset(r, 0, lb + 1);
+	uint8_t rl = 0;
+	for (uint16_t bit = (uint16_t) la * 8; bit-- > 0;)
+	{
+		// r = (r << 1) | next bit of a
+		uint8_t carry = (a[bit >> 3] >> (bit & 7)) & 1;
+		for (uint8_t i = 0; i <= rl; i++)
+		{
+			uint8_t next = r[i] >> 7;
+			r[i] = (r[i] << 1) | carry;
+			carry = next;
+		}
+		rl = mag_normalize(r, rl + 1);
+
+		if (mag_cmp(r, rl, b, lb) >= 0)
+		{
+			rl = mag_sub(r, r, rl, b, lb);
+			q[bit >> 3] |= (1 << (bit & 7));
+		}
+	}
+	*lq = mag_normalize(q, la);
+	*lr = rl;
+}
+
+#if CALC_DECIMAL_PLACES > 0
+// Powers of 10 that fit in a uint16_t, used to scale by 10^CALC_DECIMAL_PLACES in steps (kept in flash, read with pgm_read_word)
+static const uint16_t pow10Small[5] PROGMEM = {1, 10, 100, 1000, 10000};
+
+// a = a * 10^places in place, returns the length of a (a must have room for places / 2 + 2 more bytes)
+static uint8_t mag_mul_pow10(uint8_t *a, uint8_t la, uint8_t places)
+{
+	while (places > 0)
+	{
+		uint8_t k = (places > 4) ? 4 : places;
+		la = mag_mul_small(a, la, pgm_read_word(&pow10Small[k]), 0);
+		places -= k;
+	}
+	return la;
+}
+
+// a = a / 10^places in place, returns the remainder and sets *la to the new length of a
+static uint32_t mag_div_pow10(uint8_t *a, uint8_t *la, uint8_t places)
+{
+	uint32_t rem = 0;
+	uint32_t mult = 1;
+	while (places > 0)
+	{
+		uint8_t k = (places > 4) ? 4 : places;
+		uint16_t power = pgm_read_word(&pow10Small[k]);
+		rem += mag_div_small(a, la, power) * mult;
+		mult *= power;
+		places -= k;
+	}
+	return rem;
+}
+#endif
+
+// Pushes the magnitude at mag (may be in the arena above top) onto the arena stack
+static void push_number(const uint8_t *mag, uint8_t len, uint8_t sign)
+{
+	if (len > BIGINT_MAX_BYTES || top + len + 2 > ARENA_SIZE)
+	{
+		isError = 1;
+		return;
+	}
+	memmove(ARENA + top, mag, len);
+	top += len;
+	ARENA[top++] = len;
+	ARENA[top++] = (len == 0) ? 0 : sign; // Zero is never negative
+	numCount++;
+}
+
+// Applies the operator on top of the operator stack to the top two numbers, like compute() does for int64_t
+static void bigCompute(void)
+{
+	char operator = pop(operatorSP); // pop operator from operator stack
+	if (isError) return;
+	if (numCount < 2)
+	{
+		isError = 1;
+		return;
+	}
+
+	// pop operand stack twice (operand2 is b, operand1 is a)
+	uint8_t lb = ARENA[top - 2], sb = ARENA[top - 1];
+	uint16_t startB = top - 2 - lb;
+	uint8_t la = ARENA[startB - 2], sa = ARENA[startB - 1];
+	uint16_t startA = startB - 2 - la;
+	const uint8_t *a = ARENA + startA;
+	const uint8_t *b = ARENA + startB;
+
+	// Results are built in the free space above b
+	uint8_t *r = ARENA + top;
+	if ((uint16_t) (ARENA_SIZE - top) < 3 * ((uint16_t) la + lb) + 40)
+	{
+		isError = 1;
+		return;
+	}
+
+	uint8_t lr = 0, sr = 0;
+	switch (operator) {
+		case '-':
+			sb ^= 1; // a - b = a + (-b)
+			// fall through
+		case '+':
+			if (sa == sb)
+			{
+				lr = mag_add(r, a, la, b, lb);
+				sr = sa;
+			}
+			else if (mag_cmp(a, la, b, lb) >= 0)
+			{
+				lr = mag_sub(r, a, la, b, lb);
+				sr = sa;
+			}
+			else
+			{
+				lr = mag_sub(r, b, lb, a, la);
+				sr = sb;
+			}
+			break;
+		case '*':
+			lr = mag_mul(r, a, la, b, lb);
+			sr = sa ^ sb;
+#if CALC_DECIMAL_PLACES > 0
+			// Both operands are scaled, so scale the product back down, rounding to the nearest last decimal place
+			if (mag_div_pow10(r, &lr, CALC_DECIMAL_PLACES) * 2 >= CALC_SCALE) lr = mag_mul_small(r, lr, 1, 1);
+#endif
+			break;
+		case '/':
+		{
+			if (lb == 0) // Division by zero
+			{
+				isError = 1;
+				return;
+			}
+			uint8_t *dividend = r;
+			uint8_t ld = la;
+			memcpy(dividend, a, la);
+#if CALC_DECIMAL_PLACES > 0
+			ld = mag_mul_pow10(dividend, ld, CALC_DECIMAL_PLACES); // Scale a up, so the quotient keeps its decimal places
+#endif
+			uint8_t *q = dividend + ld + 8;
+			uint8_t *rem = q + ld + 8;
+			uint8_t *twiceRem = rem + lb + 2;
+			uint8_t lq, lrem;
+			mag_divmod(q, &lq, rem, &lrem, dividend, ld, b, lb);
+#if CALC_DECIMAL_PLACES > 0
+			if (mag_cmp(twiceRem, mag_add(twiceRem, rem, lrem, rem, lrem), b, lb) >= 0) lq = mag_mul_small(q, lq, 1, 1); // Round half up
+#else
+			(void) twiceRem; // Integer division truncates, like int64_t
+#endif
+			r = q;
+			lr = lq;
+			sr = sa ^ sb;
+		}
+			break;
+	}
+
+	// Replace a and b with the result
+	top = startA;
+	numCount -= 2;
+	push_number(r, lr, sr);
+}
+
+// Parses the number starting at infix[*i] onto the arena stack, and leaves *i on its last character
+static void pushLiteral(char *infix, int length, int *i)
+{
+	uint8_t *num = ARENA + top;
+	uint8_t len = 0;
+	int j = *i;
+
+	// Every digit is added as num = num * 10 + digit, fraction digits included, so num ends up scaled by 10^CALC_DECIMAL_PLACES
+	uint8_t places = 0; // Number of fraction digits used
+	uint8_t isFraction = 0;
+	uint8_t isRounded = 0;
+	for (; j < length && ((infix[j] >= 0x30 && infix[j] <= 0x39) || (CALC_DECIMAL_PLACES > 0 && infix[j] == '.' && !isFraction)); j++)
+	{
+		if (infix[j] == '.')
+		{
+			isFraction = 1;
+			continue;
+		}
+		if (len > BIGINT_MAX_BYTES || top + len + 4 > ARENA_SIZE)
+		{
+			isError = 1;
+			break;
+		}
+		if (!isFraction || places < CALC_DECIMAL_PLACES)
+		{
+			len = mag_mul_small(num, len, 10, infix[j] - '0');
+			places += isFraction;
+		}
+		else if (!isRounded) // first digit past CALC_DECIMAL_PLACES, round the number with it
+		{
+			if (infix[j] >= '5') len = mag_mul_small(num, len, 1, 1);
+			isRounded = 1;
+		}
+	}
+#if CALC_DECIMAL_PLACES > 0
+	if (!isError) len = mag_mul_pow10(num, len, CALC_DECIMAL_PLACES - places); // Pad the missing fraction digits
+#endif
+	*i = j - 1; // the for loop in bigEval increments i again
+	push_number(num, len, 0);
+}
+
+// Converts the number on top of the arena stack to a decimal string in the arena, and returns it
+static const char *toString(void)
+{
+	uint8_t len = ARENA[top - 2], sign = ARENA[top - 1];
+	uint8_t *mag = ARENA + top;
+	char *digits = (char *) mag + len; // Digits in reverse order, at most 3 per byte
+	char *str = digits + 3 * (uint16_t) len + 2;
+	if ((uint16_t) (ARENA_SIZE - top) < 7 * (uint16_t) len + 8) return NULL;
+
+	memcpy(mag, ARENA + top - 2 - len, len);
+
+	// Two digits per division by 100
+	uint16_t count = 0;
+	do
+	{
+		uint8_t pair = mag_div_small(mag, &len, 100);
+		digits[count++] = (pair % 10) + '0';
+		digits[count++] = (pair / 10) + '0';
+	} while (len > 0);
+	while (count > 1 && digits[count - 1] == '0') count--; // Drop leading zeros
+
+	// Same format as fixedToStringBuffer: trailing zeros after the decimal point are dropped
+	char *ptr = str;
+	if (sign) *(ptr++) = '-';
+	if (count <= CALC_DECIMAL_PLACES) *(ptr++) = '0';
+	for (int16_t i = count - 1; i >= CALC_DECIMAL_PLACES; i--) *(ptr++) = digits[i];
+
+	uint8_t low = 0; // Lowest fraction digit that isn't 0
+	while (low < CALC_DECIMAL_PLACES && (low >= count || digits[low] == '0')) low++;
+	if (low < CALC_DECIMAL_PLACES)
+	{
+		*(ptr++) = '.';
+		for (int16_t i = CALC_DECIMAL_PLACES - 1; i >= low; i--) *(ptr++) = (i < count) ? digits[i] : '0';
+	}
+	*ptr = '\0';
+	return str;
+}
+
+// Evaluates infix expression with arbitrary-precision integers (scaled by 10^CALC_DECIMAL_PLACES, like infixEval)
+// Returns the result as a decimal string, which stays valid until the next evaluation
+// If the result doesn't fit in BIGINT_MAX_BYTES, or the expression can't be evaluated, "Overflow" is returned
+const char *bigEval(char *infix, int length)
+{
+	// Initialize stacks
+	operatorSP = operatorStack;
+	top = 0;
+	numCount = 0;
+	isError = 0;
+
+	for (int i = 0; i < length && !isError; i++)
+	{
+		char token = infix[i]; // Get the next token
+		switch (token)
+		{
+			case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': // Token is a number
+#if CALC_DECIMAL_PLACES > 0
+			case '.': // Number starting with the decimal point
+#endif
+				pushLiteral(infix, length, &i);
+				break;
+			case '(':
+				push(operatorSP, token); // push to operator stack
+				break;
+			case ')':
+				while ((operatorSP - operatorStack > 0) && peek(operatorSP) != '(') { // while the operator on top of the operator stack is not '('
+					bigCompute();
+				}
+				pop(operatorSP); // pop '(' from operator stack and discard it
+				break;
+			case '+': case '-': case '*': case '/':
+				while ((operatorSP - operatorStack > 0) && (getOperatorPrecedence(peek(operatorSP)) >= getOperatorPrecedence(token))) { // while the operator stack isn't empty and the operator on top of the stack has equal/greater precedence to the current operator
+					bigCompute();
+				}
+				push(operatorSP, token); // push the current operator
+				break;
+		}
+	}
+
+	while (operatorSP - operatorStack > 0) // while the operator stack isn't empty, compute
+	{
+		if (peek(operatorSP) == '(') isError = 1; // '(' without a matching ')', bigCompute would drop its operands
+		bigCompute();
+	}
+
+	const char *str = (isError || numCount == 0) ? NULL : toString();
+	if (str == NULL)
+	{
+		strcpy_P((char *) ARENA, PSTR("Overflow"));
+		str = (const char *) ARENA;
+	}
+	return str;
+}
@@ -0,0 +1,11 @@
+#ifndef BIGINT_H_
+#define BIGINT_H_
+
+#include <stdint.h>
+
+// Largest number bigEval works with, in bytes (48 bytes is about 115 decimal digits)
+#define BIGINT_MAX_BYTES 48
+
+const char *bigEval(char *infix, int length);
+
+#endif /* BIGINT_H_ */
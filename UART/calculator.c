@@ -1,4 +1,81 @@
 #include "calculator.h"
+#include "bigint.h"
+#include "trace.h"
+
+#if CALC_BIGINT
+static uint8_t isOverflow; // Set when an int64_t operation overflows during infixEval
+static const char *bigResult = 0; // Result of the last infixEval as a string, if it didn't fit in int64_t
+#endif
+
+// Checked int64_t operations; with CALC_BIGINT they set isOverflow instead of silently wrapping
+static inline int64_t add64(int64_t a, int64_t b)
+{
+#if CALC_BIGINT
+	int64_t r;
+	if (__builtin_add_overflow(a, b, &r)) isOverflow = 1;
+	return r;
+#else
+	return a + b;
+#endif
+}
+
+static inline int64_t sub64(int64_t a, int64_t b)
+{
+#if CALC_BIGINT
+	int64_t r;
+	if (__builtin_sub_overflow(a, b, &r)) isOverflow = 1;
+	return r;
+#else
+	return a - b;
+#endif
+}
+
+static inline int64_t mul64(int64_t a, int64_t b)
+{
+#if CALC_BIGINT
+	// Operands that fit in 32 bits can't overflow, so only the rare large ones pay for the full check
+	int64_t r;
+	if (((int32_t) a != a || (int32_t) b != b) && __builtin_mul_overflow(a, b, &r))
+	{
+		isOverflow = 1;
+		return r;
+	}
+#endif
+	return a * b;
+}
+
+static inline uint64_t umul64(uint64_t a, uint64_t b)
+{
+#if CALC_BIGINT
+	uint64_t r;
+	if (((uint32_t) a != a || (uint32_t) b != b) && __builtin_mul_overflow(a, b, &r))
+	{
+		isOverflow = 1;
+		return r;
+	}
+#endif
+	return a * b;
+}
+
+static inline uint64_t uadd64(uint64_t a, uint64_t b)
+{
+#if CALC_BIGINT
+	uint64_t r;
+	if (__builtin_add_overflow(a, b, &r)) isOverflow = 1;
+	return r;
+#else
+	return a + b;
+#endif
+}
+
+// Applies the sign to a magnitude, checking it fits in int64_t
+static inline int64_t toSigned(uint64_t magnitude, uint8_t isNegative)
+{
+#if CALC_BIGINT
+	if (magnitude > (uint64_t) INT64_MAX + isNegative) isOverflow = 1;
+#endif
+	return isNegative ? -(int64_t) magnitude : (int64_t) magnitude;
+}
 
 // Gets operator precedence of a specified operator
 int getOperatorPrecedence(char op)
@@ -13,6 +90,65 @@ int getOperatorPrecedence(char op)
 	}
 }
 
+#if CALC_DECIMAL_PLACES > 0
+// Multiplies two fixed-point numbers, rounding the result to the nearest last decimal place
+// Each operand is split into its integer and fraction parts, so the product only overflows if the result does
+static int64_t fixedMultiply(int64_t a, int64_t b)
+{
+	uint8_t isNegative = (a < 0) ^ (b < 0);
+	uint64_t x = (a < 0) ? -(uint64_t) a : (uint64_t) a; // Work with magnitudes, so rounding is symmetric
+	uint64_t y = (b < 0) ? -(uint64_t) b : (uint64_t) b;
+	
+	uint64_t xInt = x / CALC_SCALE, xFrac = x % CALC_SCALE;
+	uint64_t yInt = y / CALC_SCALE, yFrac = y % CALC_SCALE;
+	
+	uint64_t result = umul64(umul64(xInt, yInt), CALC_SCALE);
+	result = uadd64(result, umul64(xInt, yFrac));
+	result = uadd64(result, umul64(xFrac, yInt));
+	result = uadd64(result, (xFrac * yFrac + CALC_SCALE / 2) / CALC_SCALE);
+	return toSigned(result, isNegative);
+}
+
+// Divides two fixed-point numbers, rounding the result to the nearest last decimal place
+static int64_t fixedDivide(int64_t a, int64_t b)
+{
+	uint8_t isNegative = (a < 0) ^ (b < 0);
+	uint64_t x = (a < 0) ? -(uint64_t) a : (uint64_t) a;
+	uint64_t y = (b < 0) ? -(uint64_t) b : (uint64_t) b;
+	
+	uint64_t quotient = x / y;
+	uint64_t remainder = x - quotient * y;
+	
+	// Find remainder * CALC_SCALE / y one bit of CALC_SCALE at a time (shift and subtract), so remainder * CALC_SCALE never overflows
+	// rem stays less than y, and y is at most 2^63, so doubling rem or adding remainder to it can't overflow either
+	uint64_t frac = 0;
+	uint64_t rem = 0;
+	for (uint32_t bit = 1UL << 31; bit != 0; bit >>= 1)
+	{
+		frac <<= 1;
+		rem <<= 1;
+		if (rem >= y)
+		{
+			rem -= y;
+			frac++;
+		}
+		if ((uint32_t) CALC_SCALE & bit)
+		{
+			rem += remainder;
+			if (rem >= y)
+			{
+				rem -= y;
+				frac++;
+			}
+		}
+	}
+	if (rem >= y - rem) frac++; // Round half up
+	
+	uint64_t result = uadd64(umul64(quotient, CALC_SCALE), frac);
+	return toSigned(result, isNegative);
+}
+#endif
+
 void compute() {
 	char operator = pop(operatorSP); // pop operator from operator stack
 	
@@ -22,26 +158,44 @@ void compute() {
 	
 	switch (operator) { // apply operator to operands, and push result to operand stack
 		case '+':
-			push(operandSP, operand1 + operand2);
+			push(operandSP, add64(operand1, operand2));
 			break;
 		case '-':
-			push(operandSP, operand1 - operand2);
+			push(operandSP, sub64(operand1, operand2));
 			break;
+#if CALC_DECIMAL_PLACES > 0
 		case '*':
-			push(operandSP, operand1 * operand2);
+			push(operandSP, fixedMultiply(operand1, operand2));
 			break;
 		case '/':
+			push(operandSP, fixedDivide(operand1, operand2));
+			break;
+#else
+		case '*':
+			push(operandSP, mul64(operand1, operand2));
+			break;
+		case '/':
+#if CALC_BIGINT
+			if (operand1 == INT64_MIN && operand2 == -1) isOverflow = 1; // The only int64_t division that overflows
+#endif
 			push(operandSP, operand1 / operand2);
 			break;
+#endif
 	}
 }
 
 // Evaluates infix expression
 int64_t infixEval(char *infix, int length)
 {
+	TRACE(TRACE_EVAL_BEGIN, length);
+	
 	// Initialize stacks
 	operatorSP = operatorStack;
 	operandSP = operandStack;
+#if CALC_BIGINT
+	isOverflow = 0;
+	bigResult = 0;
+#endif
 	
 	for (int i = 0; i < length; i++)
 	{
@@ -49,13 +203,39 @@ int64_t infixEval(char *infix, int length)
 		switch (token)
 		{
 			case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': // Token is a number
+#if CALC_DECIMAL_PLACES > 0
+			case '.': // Number starting with the decimal point
+#endif
 			{
-				int64_t num = token - '0';
-				while (i+1 < length && (infix[i+1] >= 0x30 && infix[i+1] <= 0x39)) {
-					num *= 10; // shift current decimal number one place to the left
-					num += infix[i+1] - '0'; // put next number in 0's place
+				int64_t num = 0;
+				while (i < length && (infix[i] >= 0x30 && infix[i] <= 0x39)) {
+					num = mul64(num, 10); // shift current decimal number one place to the left
+					num = add64(num, infix[i] - '0'); // put next number in 0's place
 					i++;
 				}
+#if CALC_DECIMAL_PLACES > 0
+				num = mul64(num, CALC_SCALE); // scale the integer part
+				if (i < length && infix[i] == '.')
+				{
+					uint32_t place = CALC_SCALE / 10; // value of the next fraction digit
+					uint8_t isRounded = 0;
+					i++;
+					while (i < length && (infix[i] >= 0x30 && infix[i] <= 0x39)) {
+						if (place != 0) // digit fits in CALC_DECIMAL_PLACES
+						{
+							num = add64(num, (int64_t) (infix[i] - '0') * place);
+							place /= 10;
+						}
+						else if (!isRounded) // first digit past CALC_DECIMAL_PLACES, round the number with it
+						{
+							if (infix[i] >= '5') num++;
+							isRounded = 1;
+						}
+						i++;
+					}
+				}
+#endif
+				i--; // i is now past the number, and the for loop will increment it again
 				push(operandSP, num); // push to operand stack
 			}
 				break;
@@ -78,6 +258,21 @@ int64_t infixEval(char *infix, int length)
 	}
 
 	while (operatorSP - operatorStack > 0) compute(); // while the operator stack isn't empty, compute	
-		
-	return pop(operandSP); // return the value at top of operand stack 
+	
+	int64_t result = pop(operandSP); // the value at top of operand stack
+#if CALC_BIGINT
+	if (isOverflow) bigResult = bigEval(infix, length); // int64_t overflowed somewhere, evaluate again with arbitrary precision
+#endif
+	TRACE(TRACE_EVAL_END, calcBigResult() != 0);
+	return result;
+}
+
+// Returns the result of the last infixEval as a string if it didn't fit in int64_t (the int64_t result is then wrong), or 0 if it did
+const char *calcBigResult(void)
+{
+#if CALC_BIGINT
+	return bigResult;
+#else
+	return 0;
+#endif
 }
@@ -4,6 +4,38 @@
 
 #include <stdint.h>
 
+// Number of decimal places in fixed-point mode; operands and results are int64_t scaled by 10^CALC_DECIMAL_PLACES
+// 0 -> integer mode (whole numbers only, division truncates), max 9
+#define CALC_DECIMAL_PLACES 4
+
+#if CALC_DECIMAL_PLACES == 0
+#define CALC_SCALE 1LL
+#elif CALC_DECIMAL_PLACES == 1
+#define CALC_SCALE 10LL
+#elif CALC_DECIMAL_PLACES == 2
+#define CALC_SCALE 100LL
+#elif CALC_DECIMAL_PLACES == 3
+#define CALC_SCALE 1000LL
+#elif CALC_DECIMAL_PLACES == 4
+#define CALC_SCALE 10000LL
+#elif CALC_DECIMAL_PLACES == 5
+#define CALC_SCALE 100000LL
+#elif CALC_DECIMAL_PLACES == 6
+#define CALC_SCALE 1000000LL
+#elif CALC_DECIMAL_PLACES == 7
+#define CALC_SCALE 10000000LL
+#elif CALC_DECIMAL_PLACES == 8
+#define CALC_SCALE 100000000LL
+#elif CALC_DECIMAL_PLACES == 9
+#define CALC_SCALE 1000000000LL
+#else
+#error "CALC_DECIMAL_PLACES must be between 0 and 9"
+#endif
+
+// 1 -> an expression that overflows int64_t is evaluated again with arbitrary-precision integers (see bigint.c)
+// Expressions that fit still only use int64_t, the only added cost is checking each operation for overflow
+#define CALC_BIGINT 1
+
 char operatorStack[100];
 char* operatorSP;
 
@@ -15,6 +47,7 @@ int64_t* operandSP;
 #define peek(sp) (*(sp - 1))
 
 int64_t infixEval(char *infix, int length);
+const char *calcBigResult(void);
 int getOperatorPrecedence(char op);
 
 #endif /* CALCULATOR_H_ */
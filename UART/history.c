@@ -0,0 +1,180 @@
+#include "history.h"
+#include <avr/eeprom.h>
+#include <string.h>
+#include <util/atomic.h>
+
+#define SLOT_ADDR(slot) ((uint16_t) (slot) * sizeof(history_entry_t)) // EEPROM address of a slot
+
+// Entry waiting to be written to EEPROM
+typedef struct history_write_t
+{
+	history_entry_t entry;
+	uint8_t slot; // Slot the entry is written to
+} history_write_t;
+
+// Write queue, drained one byte at a time by the EE_READY interrupt, so an EEPROM write (~3.3ms per byte) never blocks the caller
+static history_write_t queue[HISTORY_QUEUE_LENGTH];
+static uint8_t queueHead = 0; // Index to put the next entry in (only changed by history_add)
+static volatile uint8_t queueTail = 0; // Index of the entry being written (only changed by the ISR)
+static volatile uint8_t queueCount = 0; // Number of entries waiting to be written
+static volatile uint8_t writePos = 0; // Index of the next byte of the entry being written
+
+// Entries are written to the slots in a ring, so every slot is written equally often (wear leveling)
+static uint8_t headSlot = 0; // Slot the next entry is written to
+static uint16_t nextSeq = 0; // Sequence number of the next entry
+static uint8_t count = 0; // Number of entries stored (including the ones waiting in the queue)
+
+ISR(EE_READY_vect) // EEPROM Ready Interrupt
+{
+	while (queueCount > 0)
+	{
+		history_write_t *write = &queue[queueTail];
+		while (writePos < sizeof(history_entry_t))
+		{
+			uint16_t addr = SLOT_ADDR(write->slot) + writePos;
+			uint8_t data = ((uint8_t *) &write->entry)[writePos++];
+
+			EEAR = addr;
+			EECR |= (1 << EERE); // Read the old byte, a byte that doesn't change isn't written (saves time and wear)
+			if (EEDR == data) continue;
+
+			EEDR = data;
+			EECR |= (1 << EEMPE); // EEPE must be set within 4 cycles after EEMPE
+			EECR |= (1 << EEPE); // Start writing, this interrupt fires again once the byte is written
+			return;
+		}
+
+		// Entry is done, go to the next one
+		writePos = 0;
+		queueTail = (queueTail + 1) % HISTORY_QUEUE_LENGTH;
+		queueCount--;
+	}
+	EECR &= ~(1 << EERIE); // Nothing left to write, disable EEPROM Ready Interrupt
+}
+
+// Stops the EE_READY interrupt from starting new writes, and waits for the current byte to finish (at most ~3.3ms)
+static void eeprom_pause(void)
+{
+	EECR &= ~(1 << EERIE);
+	while (EECR & (1 << EEPE));
+}
+
+// Lets the EE_READY interrupt continue writing queued entries
+static void eeprom_resume(void)
+{
+	if (queueCount > 0) EECR |= (1 << EERIE);
+}
+
+// Returns the checksum of entry
+static uint8_t checksum(const history_entry_t *entry)
+{
+	uint8_t sum = 0;
+	for (uint8_t i = 0; i < sizeof(history_entry_t) - 1; i++) sum += ((const uint8_t *) entry)[i];
+	return sum;
+}
+
+// Reads the entry in slot from EEPROM, returns 1 if it's a valid entry
+static uint8_t read_slot(uint8_t slot, history_entry_t *entry)
+{
+	eeprom_read_block(entry, (const void *) SLOT_ADDR(slot), sizeof(history_entry_t));
+	return entry->length != 0 && entry->length <= HISTORY_EXPRESSION_LENGTH && entry->checksum == checksum(entry);
+}
+
+// Finds the newest entry in EEPROM, so new entries continue the ring after it
+void history_init(void)
+{
+	history_entry_t entry;
+	uint8_t isValid[HISTORY_SLOTS];
+	uint16_t seq[HISTORY_SLOTS];
+
+	for (uint8_t slot = 0; slot < HISTORY_SLOTS; slot++)
+	{
+		isValid[slot] = read_slot(slot, &entry);
+		seq[slot] = entry.seq;
+	}
+
+	// The newest entry is the valid slot whose next slot doesn't continue the sequence
+	for (uint8_t slot = 0; slot < HISTORY_SLOTS; slot++)
+	{
+		uint8_t next = (slot + 1) % HISTORY_SLOTS;
+		if (isValid[slot] && !(isValid[next] && seq[next] == (uint16_t) (seq[slot] + 1)))
+		{
+			headSlot = next;
+			nextSeq = seq[slot] + 1;
+			break;
+		}
+	}
+
+	// Count the entries going back from the newest one
+	count = 0;
+	while (count < HISTORY_SLOTS)
+	{
+		uint8_t slot = (headSlot + HISTORY_SLOTS - 1 - count) % HISTORY_SLOTS;
+		if (!isValid[slot] || seq[slot] != (uint16_t) (nextSeq - 1 - count)) break;
+		count++;
+	}
+}
+
+// Queues an expression and its result to be stored in the next slot, without waiting for the EEPROM
+// Returns 1 if the entry was queued, 0 if the queue is full (the entry isn't stored)
+uint8_t history_add(const char *expression, uint8_t length, int64_t result, uint8_t isBig)
+{
+	if (queueCount == HISTORY_QUEUE_LENGTH) return 0;
+	if (length > HISTORY_EXPRESSION_LENGTH) length = HISTORY_EXPRESSION_LENGTH;
+
+	history_write_t *write = &queue[queueHead];
+	memset(&write->entry, 0, sizeof(history_entry_t));
+	write->entry.seq = nextSeq++;
+	write->entry.result = result;
+	write->entry.isBig = isBig;
+	write->entry.length = length;
+	memcpy(write->entry.expression, expression, length);
+	write->entry.checksum = checksum(&write->entry);
+	write->slot = headSlot;
+
+	queueHead = (queueHead + 1) % HISTORY_QUEUE_LENGTH;
+	headSlot = (headSlot + 1) % HISTORY_SLOTS;
+	if (count < HISTORY_SLOTS) count++;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) queueCount++; // The ISR also changes queueCount
+	EECR |= (1 << EERIE); // Enable EEPROM Ready Interrupt, the ISR writes the entry
+	return 1;
+}
+
+// Gets the nth most recent entry (n = 1 is the newest) into entry
+// Returns 1 if the entry exists, 0 if there is no such entry
+uint8_t history_get(uint8_t n, history_entry_t *entry)
+{
+	if (n == 0 || n > count) return 0;
+	uint8_t slot = (headSlot + HISTORY_SLOTS - n) % HISTORY_SLOTS;
+
+	eeprom_pause();
+
+	// The entry may still be waiting in the queue
+	uint8_t isFound = 0;
+	for (uint8_t i = 0; i < queueCount; i++)
+	{
+		history_write_t *write = &queue[(queueTail + i) % HISTORY_QUEUE_LENGTH];
+		if (write->slot == slot)
+		{
+			memcpy(entry, &write->entry, sizeof(history_entry_t));
+			isFound = 1;
+		}
+	}
+	if (!isFound) isFound = read_slot(slot, entry);
+
+	eeprom_resume();
+	return isFound;
+}
+
+// Returns the number of entries stored
+uint8_t history_count(void)
+{
+	return count;
+}
+
+// Returns 1 while entries are still being written to EEPROM
+uint8_t history_is_writing(void)
+{
+	return queueCount > 0;
+}
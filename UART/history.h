@@ -0,0 +1,29 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#define HISTORY_EXPRESSION_LENGTH 50 // Longest expression that can be stored
+#define HISTORY_SLOTS 16 // Number of entries kept in EEPROM (16 * 63 bytes fits in the 1KB EEPROM)
+#define HISTORY_QUEUE_LENGTH 2 // Number of entries that can wait in SRAM to be written to EEPROM
+
+// One history entry, stored in one EEPROM slot
+typedef struct history_entry_t
+{
+	uint16_t seq; // Sequence number, increases by one for every entry, so the newest entry can be found after a reset
+	int64_t result; // Result of the expression
+	uint8_t length; // Length of expression
+	char expression[HISTORY_EXPRESSION_LENGTH];
+	uint8_t isBig; // 1 -> the result didn't fit in int64_t, so result isn't stored (recall the expression to see it)
+	uint8_t checksum; // Sum of all the other bytes, to detect slots that were never written or were cut off by a reset
+} history_entry_t;
+
+void history_init(void);
+uint8_t history_add(const char *expression, uint8_t length, int64_t result, uint8_t isBig);
+uint8_t history_get(uint8_t n, history_entry_t *entry);
+uint8_t history_count(void);
+uint8_t history_is_writing(void);
+
+#endif /* HISTORY_H_ */
@@ -0,0 +1,42 @@
+#ifndef LCD_BUS_H_
+#define LCD_BUS_H_
+
+#include <avr/io.h>
+#include <stdint.h>
+#include "LCD.h"
+
+// Transports that drive the LCD's 8 lines (RS, RW, E, BACKLIGHT and DB4-DB7, bit numbers in LCD.h), select one with LCD_BUS
+// LCD.c encodes commands into nibbles and Enable pulses, and only writes the 8 lines through lcd_bus_write
+// The backend is chosen at compile time, so every write is a direct call
+#define LCD_BUS_PCF8574 0 // PCF8574(A) I2C backpack on the TWI bus, each write is a whole I2C transfer (~300us at 100kHz)
+#define LCD_BUS_74HC595 1 // 74HC595 shift register on the hardware SPI, each write is one SPI byte and a latch pulse (~2us at 8MHz)
+
+#define LCD_BUS LCD_BUS_PCF8574
+
+#if LCD_BUS == LCD_BUS_PCF8574
+
+#define LCD_BUS_CAN_READ 1 // The PCF8574 pins can be read back, so LCD_init can check the LCD answers
+#define LCD_BUS_TWI_SPEED 100000 // SCL frequency, in Hz
+#define LCD_BUS_WRITE_US (20 * 1000000UL / LCD_BUS_TWI_SPEED) // Shortest time a write takes (START, SLA+W and data with ACKs, STOP)
+
+#elif LCD_BUS == LCD_BUS_74HC595
+
+// The 74HC595 outputs Q0-Q7 are wired like the PCF8574 backpack pins P0-P7 (Q0 -> RS, Q1 -> RW, Q2 -> E, ...)
+// Its data input goes to MOSI (PB3), its shift clock to SCK (PB5), and its latch (RCLK) to LCD_BUS_LATCH
+#define LCD_BUS_CAN_READ 0 // The shift register is output only, so the LCD can't be read (RW should be tied low)
+#define LCD_BUS_SPI_SPEED 8000000 // SCK frequency, in Hz (the 74HC595 takes up to ~25MHz at 5V)
+#define LCD_BUS_WRITE_US (8 * 1000000UL / LCD_BUS_SPI_SPEED) // Shortest time a write takes (8 SCK cycles)
+#define LCD_BUS_LATCH_PORT PORTB
+#define LCD_BUS_LATCH      PORTB2 // SS pin, it has to be an output for the SPI master anyway
+
+#else
+#error "LCD_BUS must be LCD_BUS_PCF8574 or LCD_BUS_74HC595"
+#endif
+
+void lcd_bus_init(void);
+uint8_t lcd_bus_write(LCD_t *lcd, uint8_t data);
+#if LCD_BUS_CAN_READ
+uint8_t lcd_bus_read(LCD_t *lcd, uint8_t *data);
+#endif
+
+#endif /* LCD_BUS_H_ */
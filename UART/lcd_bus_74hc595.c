@@ -0,0 +1,25 @@
+#include "lcd_bus.h"
+
+#if LCD_BUS == LCD_BUS_74HC595
+
+#include "spi_hal.h"
+#include "twi_hal.h"
+
+// Initiate the hardware SPI and the latch pin for the shift register
+void lcd_bus_init(void)
+{
+	LCD_BUS_LATCH_PORT &= ~(1 << LCD_BUS_LATCH); // Latch low, it's pulsed high after each byte
+	spi_init(LCD_BUS_SPI_SPEED); // Also sets SS (the latch pin) to an output
+}
+
+// Sets the shift register outputs to data (the backlight bit comes from lcd's isBacklightOn)
+// Returns TWI_OK, a write can't fail (the LCD functions return the same codes for every backend)
+uint8_t lcd_bus_write(LCD_t *lcd, uint8_t data)
+{
+	spi_transfer(data | (lcd->isBacklightOn << BACKLIGHT));
+	LCD_BUS_LATCH_PORT |= (1 << LCD_BUS_LATCH); // Rising edge copies the shifted byte to the outputs
+	LCD_BUS_LATCH_PORT &= ~(1 << LCD_BUS_LATCH);
+	return TWI_OK;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#include "lcd_bus.h"
+
+#if LCD_BUS == LCD_BUS_PCF8574
+
+#include "twi_hal.h"
+
+// Initiate TWI (I2C) communication for the backpack
+void lcd_bus_init(void)
+{
+	twi_init(LCD_BUS_TWI_SPEED);
+}
+
+// Sets the backpack pins to data (the backlight bit comes from lcd's isBacklightOn)
+uint8_t lcd_bus_write(LCD_t *lcd, uint8_t data)
+{
+	return twi_write(lcd->addr, data | (lcd->isBacklightOn << BACKLIGHT));
+}
+
+// Reads the backpack pins into data (pins that should be read must have been written high first)
+uint8_t lcd_bus_read(LCD_t *lcd, uint8_t *data)
+{
+	return twi_read_bytes(lcd->addr, data, 1);
+}
+
+#endif
@@ -3,26 +3,66 @@
 #include <avr/io.h>
 #include <util/delay.h>
 #include <avr/interrupt.h>
+#include <avr/wdt.h>
 #include <stdint.h>
 #include <string.h>
 #include "uart_hal.h"
 #include "LCD.h"
 #include "calculator.h"
 #include "util.h"
+#include "history.h"
+#include "trace.h"
+#include "sram.h"
+#include "lcd_bus.h"
 
-#define EXPRESSION_LENGTH 50
+#define EXPRESSION_LENGTH HISTORY_EXPRESSION_LENGTH
+
+// Sends a history entry to the host as "!n: expression = result"
+static void sendHistoryEntry(uint8_t n, history_entry_t *entry)
+{
+	uart_send_byte('!');
+	uart_send_int(n);
+	uart_send_string_P(PSTR(": "));
+	uart_send_array((uint8_t *) entry->expression, entry->length);
+	uart_send_string_P(PSTR(" = "));
+	if (entry->isBig) uart_send_string_P(PSTR("(too large to store)"));
+	else uart_send_fixed(entry->result, CALC_DECIMAL_PLACES);
+	uart_send_string_P(PSTR("\n\r"));
+}
+
+uint8_t resetFlags __attribute__((section(".noinit"))); // Cause of this reset (MCUSR), in .noinit so clearing .bss doesn't erase it
+
+void getResetFlags(void) __attribute__((naked, used, section(".init3")));
+
+// Saves and clears the reset flags, and stops the watchdog, before the C run-time start-up (runs in .init3)
+// After a watchdog reset WDRF keeps the watchdog enabled with its shortest timeout (~16ms), and nothing resets it,
+// so it has to be disabled before the start-up and LCD_init run, or the board would keep resetting
+void getResetFlags(void)
+{
+	resetFlags = MCUSR;
+	MCUSR = 0; // Clear the reset flags (WDRF has to be cleared before WDE can be), so the next reset only shows its own cause
+	wdt_disable();
+}
 
 int main(void)
 {
+	trace_init(); // Start the time base for trace events (only if TRACE_ENABLE)
 	sei(); // Enable global interrupts
 	
     uart_init(9600, 0); // Initiate UART communication
 	uint8_t data; // variable to load byte from UART communication
 	
-	LCD_t lcd = LCD_init(0b111, 2, 16, 100000, 1); // Initialize LCD and TWI communication
+	lcd_bus_init(); // Initiate the LCD's bus (TWI or SPI, see lcd_bus.h)
+	// Initialize LCD, the full power-on sequence is only needed after a power-on reset; after a brown-out the warm start
+	// resyncs the LCD and checks it answers (on buses that can read, see lcd_bus.h), and falls back to the full sequence if the dip reset the LCD too
+	LCD_t lcd = LCD_init(0b111, 2, 16, 1, !(resetFlags & (1 << PORF)));
 	LCD_display_toggle(&lcd, 1, 1, 1); // Turn cursor and cursor blink on
 	
-	uart_send_string("\n\rCommunication Start:\n\r"); // Send string "Communication Start", with a new line inserted after, and cursor at the start of the line
+	uart_send_string_P(PSTR("\n\rCommunication Start:\n\r")); // Send string "Communication Start", with a new line inserted after, and cursor at the start of the line
+	
+	history_entry_t entry; // variable to load a history entry from EEPROM
+	history_init(); // Find the stored history in EEPROM
+	if (history_get(1, &entry)) sendHistoryEntry(1, &entry); // Show the last result from before the reset
 	
 	char expression[EXPRESSION_LENGTH] = ""; // Initialize expression to empty string
 	int length = 0; // Initialize length of expression to 0
@@ -39,30 +79,88 @@ int main(void)
 			{
 				if (length == 0) // If expression is empty
 				{
-					uart_send_string("Please input an expression.\n\r");
+					uart_send_string_P(PSTR("Please input an expression.\n\r"));
 					LCD_clear_display(&lcd);
 					LCD_display_toggle(&lcd, 1, 0, 0); // Hide cursor
-					LCD_write_string(&lcd, "Please input");
+					LCD_write_string_P(&lcd, PSTR("Please input"));
 					LCD_set_cursor(&lcd, 1, 0);
-					LCD_write_string(&lcd, "an expression.");
+					LCD_write_string_P(&lcd, PSTR("an expression."));
 					isShowingResult = 1;
 				}
+				else if (expression[0] == '?') // List history command
+				{
+					uart_send_string_P(PSTR("\n\r"));
+					for (uint8_t n = history_count(); n > 0; n--)
+					{
+						if (history_get(n, &entry)) sendHistoryEntry(n, &entry);
+					}
+					memset(expression, '\0', sizeof(expression));
+					length = 0;
+					isShowingResult = 1; // The command is still on the LCD, clear it on the next key
+				}
+				else if (expression[0] == '#') // Trace dump command, sends the recorded bus events (decode with tools/trace_decode.py)
+				{
+					trace_dump();
+					memset(expression, '\0', sizeof(expression));
+					length = 0;
+					isShowingResult = 1; // The command is still on the LCD, clear it on the next key
+				}
+				else if (expression[0] == '$') // Memory command, sends the SRAM usage (static data, stack peak and free space)
+				{
+					sram_report();
+					memset(expression, '\0', sizeof(expression));
+					length = 0;
+					isShowingResult = 1; // The command is still on the LCD, clear it on the next key
+				}
+				else if (expression[0] == '!') // Recall command, "!n" puts the nth most recent expression back on the input line ("!" is the same as "!1")
+				{
+					long n = (length > 1) ? strtol(expression + 1, 0, 10) : 1; // strtol saturates instead of wrapping on a long number
+					memset(expression, '\0', sizeof(expression));
+					length = 0;
+					
+					uart_send_string_P(PSTR("\n\r"));
+					if (n >= 1 && n <= history_count() && history_get((uint8_t) n, &entry))
+					{
+						memcpy(expression, entry.expression, entry.length);
+						length = entry.length;
+						uart_send_array((uint8_t *) expression, length); // Echo recalled expression, so it can be edited or entered
+						
+						LCD_clear_display(&lcd);
+						LCD_display_toggle(&lcd, 1, 1, 1); // Show cursor and blink
+						for (int i = 0; i < length; i++)
+						{
+							if (lcd.currCol >= 15) LCD_cursor_display_shift(&lcd, 1, 0); // shift display if at right edge of screen
+							LCD_write_data(&lcd, expression[i]);
+						}
+						isShowingResult = 0;
+					}
+					else
+					{
+						uart_send_string_P(PSTR("No such entry.\n\r"));
+						isShowingResult = 1; // The command is still on the LCD, clear it on the next key
+					}
+				}
 				else // Expression is non-empty
 				{
 					int64_t val = infixEval(expression, length); // evaluate the expression
-					char buffer[20]; // Declare buffer for result of expression
-					int64ToStringBuffer(buffer, val); // convert integer val into a string in buffer
+					const char *bigResult = calcBigResult(); // result as a string, if it didn't fit in int64_t
+					uint8_t isSaved = history_add(expression, length, val, bigResult != 0); // Store the expression and result in EEPROM (written in the background)
 					
 					// Send to host pc via UART
-					uart_send_string(" = "); // send equals sign
-					uart_send_string(buffer); // send the contents of buffer
-					uart_send_string("\n\r"); // go to beginning of newline
+					uart_send_string_P(PSTR(" = ")); // send equals sign
+					if (bigResult) uart_send_string(bigResult);
+					else uart_send_fixed(val, CALC_DECIMAL_PLACES); // send the result, digits go straight to the transmitter
+					uart_send_string_P(PSTR("\n\r")); // go to beginning of newline
+					if (!isSaved) uart_send_string_P(PSTR("History is busy, this result wasn't saved.\n\r")); // Both queued EEPROM writes are still in progress
+					
+					char buffer[INT64_STRING_LENGTH]; // Declare buffer for result of expression, for the LCD
+					if (!bigResult) fixedToStringBuffer(buffer, val, CALC_DECIMAL_PLACES); // convert fixed-point val into a string in buffer
 					
 					// Put result on LCD, return cursor to home
 					LCD_display_toggle(&lcd, 1, 0, 0); // Hide cursor
 					LCD_set_cursor(&lcd, 1, 0);
 					LCD_write_data(&lcd, '=');
-					LCD_write_string(&lcd, buffer);
+					LCD_write_string(&lcd, bigResult ? (char *) bigResult : buffer);
 					LCD_return_home(&lcd);
 					isShowingResult = 1; // LCD is now showing result
 					
@@ -78,7 +176,9 @@ int main(void)
 					((data >= 0x30 && data <= 0x39) || // Ensure data is a number, or...
 					(data == 0x2B) || (data == 0x2D) || (data == 0x2A) || (data == 0x2F) || // a operator (+,-,*,/), or...
 					(data == 0x20) || // a space, or...
-					(data == 0x28) || (data == 0x29))) // parentheses
+					(CALC_DECIMAL_PLACES > 0 && data == 0x2E) || // a decimal point (in fixed-point mode), or...
+					(data == 0x28) || (data == 0x29) || // parentheses, or...
+					(length == 0 && (data == 0x21 || data == 0x3F || data == 0x23 || data == 0x24)))) // a history, trace or memory command (!, ?, #, $) at the start of the line
 				{
 					expression[length++] = (char) data; // Add data to expression, and increment length after
 					uart_send_byte(data); // Echo data on host computer
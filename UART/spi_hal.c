@@ -0,0 +1,30 @@
+#include "spi_hal.h"
+
+// Initiate the hardware SPI as master (mode 0, MSB first), with the fastest SCK that isn't above SCK_freq
+// SCK can be F_CPU divided by 2, 4, 8, ..., 128 (8MHz down to 125kHz at 16MHz)
+void spi_init(uint32_t SCK_freq)
+{
+	SPI_DDR |= (1 << SPI_SS) | (1 << SPI_MOSI) | (1 << SPI_SCK); // MISO is an input when SPI is enabled
+
+	// Find the smallest divider 2^shift that brings SCK down to SCK_freq
+	uint8_t shift = 1;
+	while (shift < 7 && (F_CPU >> shift) > SCK_freq) shift++;
+
+	// Dividers 4, 16, 64 and 128 are set by SPR1:0 = 0-3, SPI2X doubles the speed for 2, 8 and 32 (See ATmega328p datasheet pg 141)
+	uint8_t spr;
+	if (shift == 7) spr = 3;
+	else spr = (shift - 1) / 2;
+
+	if ((shift & 1) && shift != 7) SPSR |= (1 << SPI2X);
+	else SPSR &= ~(1 << SPI2X);
+
+	SPCR = (1 << SPE) | (1 << MSTR) | spr; // Enable SPI as master, SPR1:0 are bits 1:0
+}
+
+// Sends data and returns the byte received at the same time
+uint8_t spi_transfer(uint8_t data)
+{
+	SPDR = data; // Start shifting data out
+	while (!(SPSR & (1 << SPIF))); // Wait for the byte to finish (8 SCK cycles, 16 CPU cycles at F_CPU/2 -> 1us)
+	return SPDR;
+}
@@ -0,0 +1,18 @@
+#ifndef SPI_HAL_H_
+#define SPI_HAL_H_
+
+#define F_CPU 16000000UL
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// Hardware SPI pins (ATmega328p)
+#define SPI_DDR  DDRB
+#define SPI_SS   PORTB2 // Must stay an output in master mode, otherwise a low level on it switches the SPI to slave mode
+#define SPI_MOSI PORTB3
+#define SPI_SCK  PORTB5
+
+void spi_init(uint32_t SCK_freq);
+uint8_t spi_transfer(uint8_t data);
+
+#endif /* SPI_HAL_H_ */
@@ -0,0 +1,80 @@
+#include "sram.h"
+#include "uart_hal.h"
+
+// Linker symbols (avr-libc's linker script): .data and .bss are at the bottom of SRAM, the heap would start right after them,
+// and the stack grows down from RAMEND towards them (there is no malloc, so everything between the two is free)
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+
+void sram_paint(void) __attribute__((naked, used, section(".init1")));
+
+// Fills everything from the end of .bss to RAMEND with SRAM_PAINT, before main and before anything is pushed on the stack
+// Runs in .init1, before r1 is cleared and the stack pointer is set, so it's written in assembly without using the stack
+void sram_paint(void)
+{
+	__asm__ volatile (
+		"    ldi r30, lo8(__heap_start)  \n"
+		"    ldi r31, hi8(__heap_start)  \n"
+		"    ldi r24, %[paint]           \n"
+		"    ldi r25, hi8(%[end])        \n"
+		"1:  st Z+, r24                  \n"
+		"    cpi r30, lo8(%[end])        \n"
+		"    cpc r31, r25                \n"
+		"    brlo 1b                     \n"
+		"    breq 1b                     \n"
+		:
+		: [paint] "M" (SRAM_PAINT), [end] "i" (RAMEND)
+	);
+}
+
+// Returns the bytes on the stack right now
+uint16_t sram_stack_size(void)
+{
+	return RAMEND - SP;
+}
+
+// Returns the most bytes the stack has ever used, found by looking for the lowest byte that isn't SRAM_PAINT anymore
+// Includes interrupts, since they push onto the same stack
+uint16_t sram_stack_peak(void)
+{
+	uint8_t *p = &__heap_start;
+	while (p <= (uint8_t *) RAMEND && *p == SRAM_PAINT) p++;
+	return RAMEND + 1 - (uint16_t) p;
+}
+
+// Returns the bytes free between the static variables and the stack right now
+uint16_t sram_free(void)
+{
+	return SP - (uint16_t) &__heap_start + 1;
+}
+
+// Returns the bytes that have never been used by the stack, the margin left before the stack would run into the static variables
+uint16_t sram_unused(void)
+{
+	return (RAMEND + 1 - (uint16_t) &__heap_start) - sram_stack_peak();
+}
+
+// Sends a line to the host for one value
+static void send_value(const char *name, uint16_t value)
+{
+	uart_send_string_P(name);
+	uart_send_int(value);
+	uart_send_string_P(PSTR(" bytes\n\r"));
+}
+
+// Sends the SRAM usage to the host
+void sram_report(void)
+{
+	uart_send_string_P(PSTR("\n\rSRAM: "));
+	uart_send_int(RAMEND + 1 - RAMSTART);
+	uart_send_string_P(PSTR(" bytes\n\r"));
+	send_value(PSTR("  data:       "), (uint16_t) &__data_end - (uint16_t) &__data_start);
+	send_value(PSTR("  bss:        "), (uint16_t) &__bss_end - (uint16_t) &__bss_start);
+	send_value(PSTR("  stack now:  "), sram_stack_size());
+	send_value(PSTR("  stack peak: "), sram_stack_peak());
+	send_value(PSTR("  free now:   "), sram_free());
+	send_value(PSTR("  never used: "), sram_unused());
+}
@@ -0,0 +1,16 @@
+#ifndef SRAM_H_
+#define SRAM_H_
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// Byte the unused SRAM is filled with at start-up; stack bytes that still hold it were never used
+#define SRAM_PAINT 0xC5
+
+uint16_t sram_stack_size(void);
+uint16_t sram_stack_peak(void);
+uint16_t sram_free(void);
+uint16_t sram_unused(void);
+void sram_report(void);
+
+#endif /* SRAM_H_ */
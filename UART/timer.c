@@ -0,0 +1,20 @@
+#include "timer.h"
+#include <util/atomic.h>
+
+// Starts Timer1 as a free running time base, used to measure timeouts and timestamps
+// Differences between two timer_now values are correct across the wrap, as long as they are less than 32.768ms apart
+void timer_init(void)
+{
+	if (TCCR1B & (1 << CS11)) return; // Already running
+	
+	TCCR1A = 0; // Normal mode, OC1A and OC1B disconnected
+	TCCR1B = (1 << CS11); // Prescaler 8
+}
+
+// Returns the current time in timer ticks (see TIMER_US)
+uint16_t timer_now(void)
+{
+	uint16_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) now = TCNT1; // TCNT1 is read through the shared TEMP register, so an ISR mustn't access a 16 bit register in between
+	return now;
+}
@@ -0,0 +1,16 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#define F_CPU 16000000UL
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// Timer1 runs free at F_CPU/8, so it counts 2 ticks per microsecond and wraps every 32.768ms
+#define TIMER_TICKS_PER_US (F_CPU / 8000000UL)
+#define TIMER_US(us) ((uint16_t) ((us) * TIMER_TICKS_PER_US)) // Converts microseconds to timer ticks (at most 32767us)
+
+void timer_init(void);
+uint16_t timer_now(void);
+
+#endif /* TIMER_H_ */
@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+"""Decodes a trace dump from the calculator firmware (see trace.c).
+
+Capture the UART output after sending "#" and Enter (e.g. with the terminal's
+log feature), then run:
+
+    python3 trace_decode.py capture.txt             # timeline on stdout
+    python3 trace_decode.py capture.txt -o out.vcd  # VCD file for GTKWave
+
+The last dump in the capture is decoded. Reads stdin when no file is given.
+"""
+
+import argparse
+import sys
+
+# Same order as the enum in trace.h
+EVENT_NAMES = [
+    "GAP",
+    "TWI_START",
+    "TWI_STATUS",
+    "TWI_ADDR",
+    "TWI_WRITE",
+    "TWI_READ",
+    "TWI_STOP",
+    "TWI_RECOVER",
+    "UART_RX",
+    "UART_DROP",
+    "UART_TX",
+    "LCD_CMD",
+    "LCD_DATA",
+    "LCD_END",
+    "EVAL_BEGIN",
+    "EVAL_END",
+    "MARK",
+]
+
+# TWI status codes (twi_hal.h)
+TWI_STATUS = {
+    0x00: "bus error",
+    0x08: "START",
+    0x10: "repeated START",
+    0x18: "SLA+W ACK",
+    0x20: "SLA+W NACK",
+    0x28: "data ACK",
+    0x30: "data NACK",
+    0x38: "arbitration lost",
+    0x40: "SLA+R ACK",
+    0x48: "SLA+R NACK",
+    0x50: "data received, ACK",
+    0x58: "data received, NACK",
+    0xF8: "timeout",
+}
+
+TIMER_WRAP = 1 << 16  # Timer1 is 16 bits
+
+
+def parse_dump(lines):
+    """Returns (ticks per us, [(type, data, absolute ticks)]) for the last dump in lines."""
+    dump = None
+    result = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE "):
+            dump = (int(line.split()[2]), [])
+        elif line == "END":
+            result = dump
+        elif dump is not None and len(line) == 8:
+            try:
+                dump[1].append(int(line, 16))
+            except ValueError:
+                pass
+    if result is None:
+        sys.exit("No complete trace dump (TRACE ... END) found")
+
+    ticks_per_us, raw = result
+    events = []
+    now = None
+    last_time = 0
+    for word in raw:
+        time, kind, data = word >> 16, (word >> 8) & 0xFF, word & 0xFF
+        if now is None:
+            now = time
+        elif kind == 0:
+            # Timer1 wrapped data times since the last event (255 -> at least that many)
+            now += data * TIMER_WRAP + time - last_time
+        else:
+            now += (time - last_time) % TIMER_WRAP
+        last_time = time
+        events.append((kind, data, now))
+    return ticks_per_us, events
+
+
+def describe(kind, data):
+    name = EVENT_NAMES[kind] if kind < len(EVENT_NAMES) else "UNKNOWN_%02X" % kind
+    if kind == 0:
+        return "%s %s%d timer wraps" % (name, ">=" if data == 0xFF else "", data)
+    if name == "TWI_START":
+        return name + (" (repeated)" if data else "")
+    if name in ("TWI_STOP", "TWI_RECOVER"):
+        return name
+    if name == "TWI_STATUS":
+        return "%s 0x%02X %s" % (name, data, TWI_STATUS.get(data, ""))
+    if name == "TWI_ADDR":
+        return "%s 0x%02X (0x%02X %s)" % (name, data, data >> 1, "R" if data & 1 else "W")
+    if name in ("UART_RX", "UART_DROP", "UART_TX", "LCD_DATA"):
+        char = chr(data) if 0x20 <= data < 0x7F else "."
+        return "%s 0x%02X '%s'" % (name, data, char)
+    return "%s 0x%02X" % (name, data)
+
+
+def write_timeline(ticks_per_us, events, out):
+    start = events[0][2] if events else 0
+    previous = start
+    for kind, data, now in events:
+        out.write("%12.1f us  +%9.1f  %s\n" % ((now - start) / ticks_per_us, (now - previous) / ticks_per_us, describe(kind, data)))
+        previous = now
+
+
+def write_vcd(ticks_per_us, events, out):
+    # One signal per event source, a byte bus shows the last value, a busy bit shows an operation in progress,
+    # and a counter counts events that have no duration
+    signals = [
+        ("twi_busy", 1),      # START -> STOP
+        ("twi_byte", 8),      # SLA/data byte on the bus
+        ("twi_status", 8),
+        ("twi_recovers", 8),
+        ("uart_rx", 8),
+        ("uart_tx", 8),
+        ("uart_drops", 8),
+        ("lcd_busy", 1),      # LCD_CMD/LCD_DATA -> LCD_END
+        ("lcd_rs", 1),        # 1 -> data write, 0 -> command
+        ("lcd_byte", 8),
+        ("eval_busy", 1),     # EVAL_BEGIN -> EVAL_END
+        ("mark", 8),
+    ]
+    ids = {name: chr(33 + i) for i, (name, _) in enumerate(signals)}
+    widths = dict(signals)
+
+    out.write("$timescale 1ns $end\n$scope module calculator $end\n")
+    for name, width in signals:
+        out.write("$var wire %d %s %s $end\n" % (width, ids[name], name))
+    out.write("$upscope $end\n$enddefinitions $end\n")
+
+    def value(name, val):
+        if widths[name] == 1:
+            return "%d%s\n" % (val, ids[name])
+        return "b{:b} {}\n".format(val, ids[name])
+
+    out.write("#0\n$dumpvars\n")
+    for name, _ in signals:
+        out.write(value(name, 0))
+    out.write("$end\n")
+
+    start = events[0][2] if events else 0
+    counts = {"twi_recovers": 0, "uart_drops": 0}
+    last_ns = 0
+    for kind, data, now in events:
+        name = EVENT_NAMES[kind] if kind < len(EVENT_NAMES) else None
+        changes = []
+        if name == "TWI_START":
+            changes = [("twi_busy", 1)]
+        elif name == "TWI_STOP":
+            changes = [("twi_busy", 0)]
+        elif name == "TWI_STATUS":
+            changes = [("twi_status", data)]
+        elif name in ("TWI_ADDR", "TWI_WRITE", "TWI_READ"):
+            changes = [("twi_byte", data)]
+        elif name == "TWI_RECOVER":
+            counts["twi_recovers"] = (counts["twi_recovers"] + 1) & 0xFF
+            changes = [("twi_recovers", counts["twi_recovers"]), ("twi_busy", 0)]
+        elif name == "UART_RX":
+            changes = [("uart_rx", data)]
+        elif name == "UART_TX":
+            changes = [("uart_tx", data)]
+        elif name == "UART_DROP":
+            counts["uart_drops"] = (counts["uart_drops"] + 1) & 0xFF
+            changes = [("uart_drops", counts["uart_drops"])]
+        elif name in ("LCD_CMD", "LCD_DATA"):
+            changes = [("lcd_busy", 1), ("lcd_rs", name == "LCD_DATA"), ("lcd_byte", data)]
+        elif name == "LCD_END":
+            changes = [("lcd_busy", 0)]
+        elif name == "EVAL_BEGIN":
+            changes = [("eval_busy", 1)]
+        elif name == "EVAL_END":
+            changes = [("eval_busy", 0)]
+        elif name == "MARK":
+            changes = [("mark", data)]
+        if not changes:
+            continue
+
+        time_ns = (now - start) * 1000 // ticks_per_us
+        if time_ns != last_ns:
+            out.write("#%d\n" % time_ns)
+            last_ns = time_ns
+        for signal, val in changes:
+            out.write(value(signal, int(val)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a calculator trace dump into a timeline or a VCD file")
+    parser.add_argument("capture", nargs="?", help="UART capture containing a TRACE ... END dump (default: stdin)")
+    parser.add_argument("-o", "--vcd", help="write a VCD file for GTKWave instead of a timeline")
+    args = parser.parse_args()
+
+    if args.capture:
+        with open(args.capture, errors="replace") as f:
+            lines = f.read().replace("\r", "\n").split("\n")
+    else:
+        lines = sys.stdin.read().replace("\r", "\n").split("\n")
+
+    ticks_per_us, events = parse_dump(lines)
+    if args.vcd:
+        with open(args.vcd, "w") as f:
+            write_vcd(ticks_per_us, events, f)
+    else:
+        write_timeline(ticks_per_us, events, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
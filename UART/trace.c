@@ -0,0 +1,93 @@
+#include "trace.h"
+#include "uart_hal.h"
+
+#if TRACE_ENABLE
+
+trace_event_t trace_buffer[TRACE_LENGTH];
+uint8_t trace_head = 0;
+uint8_t trace_isFull = 0;
+uint8_t trace_isPaused = 0;
+volatile uint8_t trace_wraps = 0;
+
+ISR(TIMER1_OVF_vect) // Timer1 Overflow Interrupt, counts wraps so timestamps of events far apart can be told apart
+{
+	if (trace_wraps != 0xFF) trace_wraps++;
+}
+
+// Sends the low nibble of n as a hex digit
+static void send_hex_nibble(uint8_t n)
+{
+	n &= 0xF;
+	uart_send_byte(n < 10 ? '0' + n : 'A' + n - 10);
+}
+
+// Sends n as two hex digits
+static void send_hex(uint8_t n)
+{
+	send_hex_nibble(n >> 4);
+	send_hex_nibble(n);
+}
+
+#endif
+
+// Starts the Timer1 time base the events are stamped with, and counts its wraps
+void trace_init(void)
+{
+#if TRACE_ENABLE
+	timer_init();
+	TIFR1 = (1 << TOV1); // Clear an old overflow, so it isn't counted
+	TIMSK1 |= (1 << TOIE1); // Enable Timer1 Overflow Interrupt
+#endif
+}
+
+// Throws away all recorded events
+void trace_clear(void)
+{
+#if TRACE_ENABLE
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		trace_head = 0;
+		trace_isFull = 0;
+	}
+#endif
+}
+
+// Sends the recorded events over UART, oldest first, and then clears them
+// Format (decoded by tools/trace_decode.py):
+//   "TRACE <count> <ticks per us>" then one line per event "<time><type><data>" in hex (4, 2 and 2 digits), then "END"
+// Recording is paused while dumping, so the dump's own UART bytes aren't recorded
+void trace_dump(void)
+{
+#if TRACE_ENABLE
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) trace_isPaused = 1;
+
+	uint8_t count = trace_isFull ? TRACE_LENGTH : trace_head;
+	uint8_t index = trace_isFull ? trace_head : 0; // Oldest event
+
+	uart_send_string_P(PSTR("\n\rTRACE "));
+	uart_send_int(count);
+	uart_send_byte(' ');
+	uart_send_int(TIMER_TICKS_PER_US);
+	uart_send_string_P(PSTR("\n\r"));
+	for (uint8_t i = 0; i < count; i++)
+	{
+		trace_event_t *event = &trace_buffer[index];
+		send_hex(event->time >> 8);
+		send_hex(event->time & 0xFF);
+		send_hex(event->type);
+		send_hex(event->data);
+		uart_send_string_P(PSTR("\n\r"));
+		index = (index + 1) & (TRACE_LENGTH - 1);
+	}
+	uart_send_string_P(PSTR("END\n\r"));
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		trace_head = 0;
+		trace_isFull = 0;
+		trace_isPaused = 0;
+	}
+#else
+	uart_send_string_P(PSTR("\n\rTracing is disabled (TRACE_ENABLE)\n\r"));
+#endif
+}
@@ -0,0 +1,99 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdint.h>
+#include "timer.h"
+
+// 1 -> TWI, UART, LCD and evaluator events are recorded in an SRAM ring, and can be dumped over UART (see trace_dump)
+// 0 -> TRACE() compiles to nothing, so tracing costs no time or memory
+#define TRACE_ENABLE 0
+
+#define TRACE_LENGTH 64 // Number of events kept (4 bytes each), must be a power of 2, the oldest events are overwritten
+
+// Event types, tools/trace_decode.py has the same list
+enum
+{
+	TRACE_GAP,         // data: number of Timer1 wraps (32.768ms each) since the last event, up to 255
+	TRACE_TWI_START,   // START or repeated START condition sent
+	TRACE_TWI_STATUS,  // data: TWI status code the operation finished with (TWI_NONE -> timed out)
+	TRACE_TWI_ADDR,    // data: SLA+R/W byte sent
+	TRACE_TWI_WRITE,   // data: data byte sent
+	TRACE_TWI_READ,    // data: data byte received
+	TRACE_TWI_STOP,    // STOP condition sent
+	TRACE_TWI_RECOVER, // Bus recovery started
+	TRACE_UART_RX,     // data: byte received
+	TRACE_UART_DROP,   // data: byte dropped because rx_buffer was full
+	TRACE_UART_TX,     // data: byte sent
+	TRACE_LCD_CMD,     // data: instruction byte sent to the LCD (start of the command)
+	TRACE_LCD_DATA,    // data: data byte sent to the LCD (start of the write)
+	TRACE_LCD_END,     // data: TWI return value of the command/write
+	TRACE_EVAL_BEGIN,  // data: length of the expression
+	TRACE_EVAL_END,    // data: 1 -> result didn't fit in int64_t
+	TRACE_MARK         // data: anything, for temporary debugging
+};
+
+#if TRACE_ENABLE
+
+// One recorded event
+typedef struct trace_event_t
+{
+	uint16_t time; // Timer1 ticks (see TIMER_TICKS_PER_US)
+	uint8_t type;
+	uint8_t data;
+} trace_event_t;
+
+extern trace_event_t trace_buffer[TRACE_LENGTH];
+extern uint8_t trace_head; // Index the next event is put in
+extern uint8_t trace_isFull; // 1 -> the ring has wrapped, every entry holds an event
+extern uint8_t trace_isPaused; // 1 -> events aren't recorded (while dumping)
+extern volatile uint8_t trace_wraps; // Timer1 wraps since the last event
+
+// Puts an event in the ring, inline so an event only costs ~30 cycles (a few more after an idle gap)
+// Safe to call from ISRs and from main
+static inline void trace_event(uint8_t type, uint8_t data)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (!trace_isPaused)
+		{
+			uint16_t time = TCNT1; // Interrupts are off, so the 16 bit read is safe
+			if ((TIFR1 & (1 << TOV1)) && time < 0x8000) // Timer1 wrapped before time was read, but its interrupt hasn't run yet
+			{
+				TIFR1 = (1 << TOV1); // Count the wrap here instead
+				if (trace_wraps != 0xFF) trace_wraps++;
+			}
+			if (trace_wraps != 0) // Timer1 wrapped since the last event, record how often so the decoder can keep the timeline
+			{
+				trace_buffer[trace_head].time = time;
+				trace_buffer[trace_head].type = TRACE_GAP;
+				trace_buffer[trace_head].data = trace_wraps;
+				trace_head = (trace_head + 1) & (TRACE_LENGTH - 1);
+				if (trace_head == 0) trace_isFull = 1;
+				trace_wraps = 0;
+			}
+			
+			trace_buffer[trace_head].time = time;
+			trace_buffer[trace_head].type = type;
+			trace_buffer[trace_head].data = data;
+			trace_head = (trace_head + 1) & (TRACE_LENGTH - 1);
+			if (trace_head == 0) trace_isFull = 1;
+		}
+	}
+}
+
+#define TRACE(type, data) trace_event((type), (data))
+
+#else
+
+#define TRACE(type, data) ((void) 0)
+
+#endif
+
+void trace_init(void);
+void trace_clear(void);
+void trace_dump(void);
+
+#endif /* TRACE_H_ */
@@ -1,7 +1,11 @@
 #include "twi_hal.h"
 #include "uart_hal.h"
+#include "timer.h"
+#include "trace.h"
+#include <util/delay.h>
 
 volatile uint8_t status = 0xF8;
+static uint16_t recoveryCount = 0; // Number of times the bus has been recovered
 
 ISR(TWI_vect)
 {
@@ -14,6 +18,8 @@ void twi_init(uint32_t SCL_freq)
 	uint32_t twbr = ((F_CPU/SCL_freq) - 16)/2; // Bit Rate Generator Unit (See ATmega328p datasheet pg 180)
 	TWBR = twbr & 0xFF; // TWBR is 1 byte
 	
+	timer_init(); // Timeouts are measured with the Timer1 time base
+	
 	TWCR = (1 << TWEN) | (1 << TWIE); // Set TWI Enable Bit to 1, set TWI Interrupt Enable to 1
 	
 	// Prescaler Value is 1, so TWPS1 and TWPS0 are 0, so no need to set TWI Status Register (TWSR) since the initial values for TWPS1 and TWPS0 are 0
@@ -22,147 +28,245 @@ void twi_init(uint32_t SCL_freq)
 	PORTC |= (1 << PORTC4) | (1 << PORTC5);
 }
 
+// Writes twcr to TWCR to start the next bus operation, and clears the last status
+// status has to be cleared, otherwise waiting for a status code that repeats (e.g. TWI_MR_DATA_ACK for every byte read) would return right away
+// The ISR keeps setting status while TWINT is set, so status is only cleared after TWINT is cleared by writing twcr
+static void twi_command(uint8_t twcr)
+{
+	TWCR = twcr;
+	status = TWI_NONE;
+}
+
+// Waits for the bus operation started by twi_command to finish with status expected
+// Returns TWI_OK if it did, err if it finished with another status (e.g. a NACK), TWI_ERROR_ARB_LOST or TWI_ERROR_BUS if the master lost the bus,
+// or TWI_ERROR_TIMEOUT if it didn't finish within TWI_TIMEOUT_US
+static uint8_t twi_wait(uint8_t expected, uint8_t err)
+{
+	uint16_t start = timer_now();
+	uint8_t code;
+	while ((code = status) == TWI_NONE) // No status yet
+	{
+		if ((uint16_t) (timer_now() - start) >= TIMER_US(TWI_TIMEOUT_US))
+		{
+			TRACE(TRACE_TWI_STATUS, TWI_NONE);
+			return TWI_ERROR_TIMEOUT;
+		}
+	}
+	TRACE(TRACE_TWI_STATUS, code);
+	
+	if (code == expected) return TWI_OK;
+	if (code == TWI_ERROR) return TWI_ERROR_ARB_LOST;
+	if (code == TWI_BUS_ERROR) return TWI_ERROR_BUS;
+	return err;
+}
+
 // Master sends start condition
 static uint8_t twi_start(void)
 {
-	uint16_t timeoutTimer = 0;
-	TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE); 
+	TRACE(TRACE_TWI_START, 0);
+	twi_command((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE));
 	
-	// Wait for status to be TWI_START; if it doesn't change in time, then TWI_ERROR_START is returned
-	while (status != TWI_START) if (++timeoutTimer >= TWI_TIMEOUT) return TWI_ERROR_START;
-	return TWI_OK;
+	// Wait for status to be TWI_START
+	return twi_wait(TWI_START, TWI_ERROR_START);
 }
 
 // Master sends stop condition
 static void twi_stop(void)
 {
+	TRACE(TRACE_TWI_STOP, 0);
 	TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN) | (1 << TWIE);
 }
 
 // Master sends repeated start condition
 static uint8_t twi_re_start(void)
 {
-	uint16_t timeoutTimer = 0;
-	TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+	TRACE(TRACE_TWI_START, 1);
+	twi_command((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE));
 	
-	// Wait for status to be TWI_RE_START; if it doesn't change in time, then TWI_ERROR_RE_START is returned
-	while (status != TWI_RE_START) if (++timeoutTimer >= TWI_TIMEOUT) return TWI_ERROR_RE_START;
-	return TWI_OK;
+	// Wait for status to be TWI_RE_START
+	return twi_wait(TWI_RE_START, TWI_ERROR_RE_START);
 }
 
 // Clears TWINT (by setting it to 1), and waits for SLA+R acknowledgment from slave
 static uint8_t twi_sla_r(void)
 {
-	uint16_t timeoutTimer = 0;
-	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+	twi_command((1 << TWINT) | (1 << TWEN) | (1 << TWIE));
 	
-	while (status != TWI_MR_SLA_R_ACK) if (++timeoutTimer >= TWI_TIMEOUT) return TWI_ERROR_SLA_R;
-	return TWI_OK;
+	return twi_wait(TWI_MR_SLA_R_ACK, TWI_ERROR_SLA_R);
 }
 
 // Sends a data acknowledge or not acknowledge from master
 static uint8_t twi_data_r_ack(uint8_t ack)
 {
-	uint16_t timeoutTimer = 0;
 	if (ack != 0)
 	{
-		TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE) | (1 << TWEA); // Acknowledge
-		while (status != TWI_MR_DATA_ACK) if (++timeoutTimer >= TWI_TIMEOUT) return TWI_ERROR_DATA_R;
+		twi_command((1 << TWINT) | (1 << TWEN) | (1 << TWIE) | (1 << TWEA)); // Acknowledge
+		return twi_wait(TWI_MR_DATA_ACK, TWI_ERROR_DATA_R);
 	}
 	else
 	{
-		TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE); // Not Acknowledge
-		while (status != TWI_MR_DATA_NACK) if (++timeoutTimer >= TWI_TIMEOUT) return TWI_ERROR_DATA_R;
+		twi_command((1 << TWINT) | (1 << TWEN) | (1 << TWIE)); // Not Acknowledge
+		return twi_wait(TWI_MR_DATA_NACK, TWI_ERROR_DATA_R);
 	}
-	return TWI_OK;
 }
 
 // Clears TWINT (by setting it to 1), and waits for SLA+W acknowledgment from slave
 static uint8_t twi_sla_w(void)
 {
-	uint16_t timeoutTimer = 0;
-	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+	twi_command((1 << TWINT) | (1 << TWEN) | (1 << TWIE));
 	
-	while (status != TWI_MT_SLA_W_ACK) if (++timeoutTimer >= TWI_TIMEOUT) return TWI_ERROR_SLA_W;
-	return TWI_OK;
+	return twi_wait(TWI_MT_SLA_W_ACK, TWI_ERROR_SLA_W);
 }
 
 // Clears TWINT (by setting it to 1), and waits for data acknowledgment from slave
 static uint8_t twi_data_w_ack(void)
 {
-	uint16_t timeoutTimer = 0;
-	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+	twi_command((1 << TWINT) | (1 << TWEN) | (1 << TWIE));
 	
-	while (status != TWI_MT_DATA_ACK) if (++timeoutTimer >= TWI_TIMEOUT) return TWI_ERROR_DATA_W;
-	return TWI_OK;
+	return twi_wait(TWI_MT_DATA_ACK, TWI_ERROR_DATA_W);
 }
 
-// Writes data of length len in bytes to device address addr
-uint8_t twi_write_bytes(uint8_t addr, uint8_t *data, uint16_t len)
+// Frees a bus that is stuck, and counts the recovery
+// A slave that lost track of the clock can hold SDA low forever, so SCL is clocked by hand (up to 9 times, enough to finish any byte and its ACK)
+// until the slave lets go of SDA, then a STOP condition is sent and TWI is enabled again
+void twi_recover(void)
 {
-	uint8_t err = TWI_OK;
+	TRACE(TRACE_TWI_RECOVER, 0);
+	TWCR = 0; // Disable TWI, so SDA (PC4) and SCL (PC5) are normal I/O pins
 	
-	err = twi_start(); // Send START condition
-	if (err != TWI_OK) // Validate START condition sent successfully
+	// Pins are driven like an open drain: low by outputting 0, high by releasing them to the pull-up resistors
+	DDRC &= ~((1 << DDC4) | (1 << DDC5));
+	PORTC |= (1 << PORTC4) | (1 << PORTC5);
+	
+	for (uint8_t i = 0; i < 9 && !(PINC & (1 << PINC4)); i++) // While SDA is held low
 	{
-		twi_stop(); // Send STOP condition if it's not OK
-		return err;
+		PORTC &= ~(1 << PORTC5); // SCL low
+		DDRC |= (1 << DDC5);
+		_delay_us(5);
+		DDRC &= ~(1 << DDC5); // SCL released (high)
+		PORTC |= (1 << PORTC5);
+		_delay_us(5);
 	}
 	
-	TWDR = (addr << 1) | 0; // Enter MR Mode by transmitting SLA+W (By writing SLA+W to TWDR)
+	// STOP condition: SDA goes high while SCL is high
+	PORTC &= ~(1 << PORTC4); // SDA low
+	DDRC |= (1 << DDC4);
+	_delay_us(5);
+	DDRC &= ~(1 << DDC4); // SDA released (high)
+	PORTC |= (1 << PORTC4);
+	_delay_us(5);
+	
+	status = TWI_NONE;
+	TWCR = (1 << TWEN) | (1 << TWIE); // Enable TWI again (TWBR keeps the bus speed)
+	recoveryCount++;
+}
+
+// Returns the number of times the bus has been recovered since reset
+uint16_t twi_recovery_count(void)
+{
+	return recoveryCount;
+}
+
+// Ends a transfer with a STOP condition, or recovers the bus if the transfer failed because the bus is stuck or was lost
+// Returns err
+static uint8_t twi_end(uint8_t err)
+{
+	if (err == TWI_ERROR_TIMEOUT || err == TWI_ERROR_ARB_LOST || err == TWI_ERROR_BUS) twi_recover(); // Recovery sends its own STOP condition
+	else twi_stop();
+	return err;
+}
+
+// Sends SLA+W and then data of length len in bytes, after a START or repeated START condition has been sent
+static uint8_t twi_send_data(uint8_t addr, uint8_t *data, uint16_t len)
+{
+	uint8_t err = TWI_OK;
+	
+	TWDR = (addr << 1) | 0; // Enter MT Mode by transmitting SLA+W (By writing SLA+W to TWDR)
+	TRACE(TRACE_TWI_ADDR, (addr << 1) | 0);
 	
 	err = twi_sla_w(); // Continue transfer by writing 1 to TWINT, and wait for acknowledged
-	if (err != TWI_OK) // Validate SLA+W sent successfully, and received acknowledged
-	{
-		twi_stop(); // Send STOP condition if it's not OK
-		return err;
-	}
+	if (err != TWI_OK) return err; // Validate SLA+W sent successfully, and received acknowledged
 	
 	// Transmit data packet (by writing the data byte to TWDR)
-	for (int i = 0; i < len; i++)
+	for (uint16_t i = 0; i < len; i++)
 	{
 		TWDR = data[i]; // Write current data byte to transmit to TWDR
+		TRACE(TRACE_TWI_WRITE, data[i]);
 		err = twi_data_w_ack(); // Continue the transfer by writing 1 to TWINT, and wait for acknowledged
-		if (err != TWI_OK) // Validate data sent successfully, and received acknowledged
-		{
-			twi_stop(); // Send STOP condition if it's not OK
-			return err;
-		}
+		if (err != TWI_OK) return err; // Validate data sent successfully, and received acknowledged
 	}
+	return err;
+}
+
+// Sends SLA+R and then reads len bytes into data, after a START or repeated START condition has been sent
+// Every byte is acknowledged except the last one, which tells the slave the read is over
+static uint8_t twi_receive_data(uint8_t addr, uint8_t *data, uint16_t len)
+{
+	uint8_t err = TWI_OK;
+	
+	TWDR = (addr << 1) | 1; // Enter MR Mode by transmitting SLA+R (By writing SLA+R to TWDR)
+	TRACE(TRACE_TWI_ADDR, (addr << 1) | 1);
+	
+	err = twi_sla_r(); // Continue transfer by writing 1 to TWINT, and wait for acknowledged
+	if (err != TWI_OK) return err; // Validate SLA+R sent successfully, and received acknowledged
 	
-	twi_stop(); // Send STOP condition after all data is sent and acknowledged
+	for (uint16_t i = 0; i < len; i++)
+	{
+		err = twi_data_r_ack(i + 1 < len); // Receive the next byte, ACK all but the last byte
+		if (err != TWI_OK) return err;
+		data[i] = TWDR; // Received byte is in TWDR
+		TRACE(TRACE_TWI_READ, data[i]);
+	}
 	return err;
 }
 
+// Writes data of length len in bytes to device address addr
+uint8_t twi_write_bytes(uint8_t addr, uint8_t *data, uint16_t len)
+{
+	uint8_t err = TWI_OK;
+	
+	err = twi_start(); // Send START condition
+	if (err == TWI_OK) err = twi_send_data(addr, data, len); // Validate START condition sent successfully, then send SLA+W and data
+	
+	return twi_end(err); // Send STOP condition after all data is sent and acknowledged (or on error)
+}
+
+// Reads len bytes from device address addr into data
+uint8_t twi_read_bytes(uint8_t addr, uint8_t *data, uint16_t len)
+{
+	uint8_t err = TWI_OK;
+	if (len == 0) return err; // Nothing to read
+	
+	err = twi_start(); // Send START condition
+	if (err == TWI_OK) err = twi_receive_data(addr, data, len); // Validate START condition sent successfully, then send SLA+R and read data
+	
+	return twi_end(err); // Send STOP condition after all data is read (or on error)
+}
+
+// Writes wlen bytes of wdata (e.g. a register address) to device address addr, then sends a repeated START and reads rlen bytes into rdata
+// The whole transfer is one bus transaction, so a multi-register read needs only one START/STOP
+uint8_t twi_write_read(uint8_t addr, uint8_t *wdata, uint16_t wlen, uint8_t *rdata, uint16_t rlen)
+{
+	uint8_t err = TWI_OK;
+	
+	err = twi_start(); // Send START condition
+	if (err == TWI_OK) err = twi_send_data(addr, wdata, wlen); // Send SLA+W and data
+	if (err == TWI_OK && rlen != 0)
+	{
+		err = twi_re_start(); // Send repeated START condition, keeping control of the bus
+		if (err == TWI_OK) err = twi_receive_data(addr, rdata, rlen); // Send SLA+R and read data
+	}
+	
+	return twi_end(err); // Send STOP condition after the transfer (or on error)
+}
+
 // Writes a data byte to device address addr
 uint8_t twi_write(uint8_t addr, uint8_t data)
 {
 		uint8_t err = TWI_OK;
 		
 		err = twi_start(); // Send START condition
-		if (err != TWI_OK) // Validate START condition sent successfully
-		{
-			twi_stop(); // Send STOP condition if it's not OK
-			return err;
-		}
-		
-		TWDR = (addr << 1) | 0; // Enter MR Mode by transmitting SLA+W (By writing SLA+W to TWDR)
-		
-		err = twi_sla_w(); // Continue transfer by writing 1 to TWINT, and wait for acknowledged
-		if (err != TWI_OK) // Validate SLA+W sent successfully, and received acknowledged
-		{
-			twi_stop(); // Send STOP condition if it's not OK
-			return err;
-		}
-		
-		// Transmit data packet (by writing the data byte to TWDR)
-		TWDR = data; // Write current data byte to transmit to TWDR
-		err = twi_data_w_ack(); // Continue the transfer by writing 1 to TWINT, and wait for acknowledged
-		if (err != TWI_OK) // Validate data sent successfully, and received acknowledged
-		{
-			twi_stop(); // Send STOP condition if it's not OK
-			return err;
-		}
+		if (err == TWI_OK) err = twi_send_data(addr, &data, 1); // Validate START condition sent successfully, then send SLA+W and data
 		
 		// Code for debugging data sent via TWI
 		/*
@@ -174,6 +278,5 @@ uint8_t twi_write(uint8_t addr, uint8_t data)
 		uart_send_string("\n\r");
 		*/
 		
-		twi_stop(); // Send STOP condition after all data is sent and acknowledged
-		return err;
+		return twi_end(err); // Send STOP condition after all data is sent and acknowledged (or on error)
 }
@@ -11,7 +11,8 @@
 // General Status Codes
 #define TWI_START         0x08
 #define TWI_RE_START      0x10
-#define TWI_ERROR         0x38
+#define TWI_ERROR         0x38 // Arbitration lost
+#define TWI_BUS_ERROR     0x00 // Illegal START or STOP condition
 #define TWI_NONE          0xF8
 
 // Master Transmitter (MT) Mode Status Codes
@@ -36,14 +37,23 @@ enum
 	TWI_ERROR_SLA_W,
 	TWI_ERROR_DATA_R,
 	TWI_ERROR_DATA_W,
-	TWI_NACK
+	TWI_NACK,
+	TWI_ERROR_TIMEOUT,
+	TWI_ERROR_ARB_LOST,
+	TWI_ERROR_BUS
 };
 
-// Timeout value
-#define TWI_TIMEOUT 1600
+// Longest time to wait for one bus operation (START, SLA+R/W or a data byte) to finish, in microseconds
+// A byte takes ~90us at 100kHz, the rest is margin for slaves stretching the clock
+// A transfer of n bytes blocks for at most (n + 2) * TWI_TIMEOUT_US, plus ~110us for twi_recover if it times out
+#define TWI_TIMEOUT_US 1000
 
 void twi_init(uint32_t speed);
 uint8_t twi_write(uint8_t addr, uint8_t data);
 uint8_t twi_write_bytes(uint8_t addr, uint8_t *data, uint16_t len);
+uint8_t twi_read_bytes(uint8_t addr, uint8_t *data, uint16_t len);
+uint8_t twi_write_read(uint8_t addr, uint8_t *wdata, uint16_t wlen, uint8_t *rdata, uint16_t rlen);
+void twi_recover(void);
+uint16_t twi_recovery_count(void);
 
 #endif /* TWI_HAL_H_ */
\ No newline at end of file
@@ -1,16 +1,66 @@
 
 #include "uart_hal.h"
+#include <util/atomic.h>
+#include "trace.h"
 
 volatile static uint8_t rx_buffer[RX_BUFFER_SIZE] = {0}; // Circular buffer
 volatile static uint16_t rx_count = 0;
+volatile static uint16_t rx_dropped = 0; // Number of bytes dropped because rx_buffer was full
+volatile static uint8_t is_rx_stopped = 0; // 1 -> the host has been told to stop sending
+
+#if UART_FLOW_CONTROL == UART_FLOW_XONXOFF
+volatile static uint8_t flow_byte = 0; // XON or XOFF waiting to be sent, 0 -> none
+
+ISR(USART_UDRE_vect) // Data Register Empty Interrupt, only enabled while an XON/XOFF is waiting
+{
+	UDR0 = flow_byte; // XON/XOFF goes out ahead of any other data
+	flow_byte = 0;
+	UCSR0B &= ~(1 << UDRIE0);
+}
+#endif
+
+// Tells the host to stop sending (called with interrupts disabled)
+static inline void flow_stop(void)
+{
+	is_rx_stopped = 1;
+#if UART_FLOW_CONTROL == UART_FLOW_XONXOFF
+	flow_byte = XOFF;
+	UCSR0B |= (1 << UDRIE0); // Send XOFF as soon as the transmitter is free
+#elif UART_FLOW_CONTROL == UART_FLOW_RTSCTS
+	UART_RTS_PORT |= (1 << UART_RTS); // RTS high -> host must stop
+#endif
+}
+
+// Tells the host to start sending again (called with interrupts disabled)
+static inline void flow_start(void)
+{
+	is_rx_stopped = 0;
+#if UART_FLOW_CONTROL == UART_FLOW_XONXOFF
+	flow_byte = XON;
+	UCSR0B |= (1 << UDRIE0); // Send XON as soon as the transmitter is free
+#elif UART_FLOW_CONTROL == UART_FLOW_RTSCTS
+	UART_RTS_PORT &= ~(1 << UART_RTS); // RTS low -> host may send
+#endif
+}
 
 ISR(USART_RX_vect) // Receiver Complete Interrupt
 {
 	volatile static int rx_write_pos = 0; // The index of rx_buffer to write a new byte to, and make this variable local to this function (static)
 	
-	rx_buffer[rx_write_pos++] = UDR0; // Get the data in the RXB in UDR0 (reading from UDR0 returns the contents of RXB), and increment rx_write_pos after
+	uint8_t data = UDR0; // Get the data in the RXB in UDR0 (reading from UDR0 returns the contents of RXB)
+	if (rx_count >= RX_BUFFER_SIZE) // Buffer is full, drop the new byte instead of overwriting unread bytes
+	{
+		rx_dropped++;
+		TRACE(TRACE_UART_DROP, data);
+		return;
+	}
+	TRACE(TRACE_UART_RX, data);
+	
+	rx_buffer[rx_write_pos++] = data; // Put data in rx_buffer, and increment rx_write_pos after
 	rx_count++; // Increase the number of received messages by 1
 	rx_write_pos %= RX_BUFFER_SIZE; // Limit rx_write_pos to be less than RX_BUFFER_SIZE, so rx_write_pos == RX_BUFFER_SIZE wraps around to 0
+	
+	if (UART_FLOW_CONTROL != UART_FLOW_NONE && !is_rx_stopped && rx_count >= RX_HIGH_WATERMARK) flow_stop();
 }
 
 // Initializes registers for UART communication with host computer
@@ -35,13 +85,40 @@ void uart_init(uint32_t baudRate, uint8_t high_speed)
 			
 	// Set parity mode
 	UCSR0C |= (1 << UPM01); // parity mode enabled, even parity
+	
+#if UART_FLOW_CONTROL == UART_FLOW_RTSCTS
+	UART_RTS_PORT &= ~(1 << UART_RTS); // RTS low, host may send
+	UART_RTS_DDR |= (1 << UART_RTS); // RTS is an output
+	UART_CTS_DDR &= ~(1 << UART_CTS); // CTS is an input
+	UART_CTS_PORT |= (1 << UART_CTS); // with pull-up, so a disconnected CTS stops transmitting
+#endif
 }
 
 // Sends one byte through the transmitter
 void uart_send_byte(uint8_t c) 
 {
+	TRACE(TRACE_UART_TX, c);
+#if UART_FLOW_CONTROL == UART_FLOW_RTSCTS
+	while (UART_CTS_PIN & (1 << UART_CTS)); // Wait until the host is ready to receive
+#endif
+#if UART_FLOW_CONTROL == UART_FLOW_XONXOFF
+	// The UDRE interrupt can send XON/XOFF at any time, so check the transmitter is empty and fill it without being interrupted
+	// Interrupts are enabled between checks, so received bytes and XON/XOFF aren't held up while waiting
+	while (1)
+	{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			if ((UCSR0A & (1 << UDRE0)) && flow_byte == 0)
+			{
+				UDR0 = c;
+				return;
+			}
+		}
+	}
+#else
 	while (!(UCSR0A & (1 << UDRE0))); // Wait until the transmitter buffer is empty
 	UDR0 = c; // Put data in TXB buffer in UDR0 Register (The TXB buffer is the destination for data written to a UDRn register)
+#endif
 }
 
 // Sends an array of bytes through the transmitter
@@ -52,21 +129,92 @@ void uart_send_array(uint8_t *c, int length)
 	}
 }
 
-// Send a string through the transmitter
-void uart_send_string(char *str)
+// Send a string through the transmitter (the null terminator isn't sent)
+void uart_send_string(const char *str)
 {
 	int index = 0;
 	while (str[index] != '\0') {
 		uart_send_byte(str[index]); // Sends each char of a string through the transmitter
 		index++; // Increment to next char
 	}
-	uart_send_byte('\0'); // End string by sending null terminator byte
+}
+
+// Send a string stored in flash (PROGMEM, e.g. PSTR("...")) through the transmitter, without copying it to SRAM
+void uart_send_string_P(const char *str)
+{
+	char letter;
+	while ((letter = pgm_read_byte(str++)) != '\0') uart_send_byte(letter);
+}
+
+// Powers of 10 that fit in an int64_t, for streaming digits most significant first
+static const uint64_t powersOf10[19] PROGMEM =
+{
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+	10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+	1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL
+};
+
+// Removes the digit at power place from n and returns it as a character
+// Each digit is found by subtracting (at most 9 times), which is much faster on AVR than a 64 bit division
+static char next_digit(uint64_t *n, uint8_t place)
+{
+	uint64_t power;
+	memcpy_P(&power, &powersOf10[place], sizeof(power));
+	
+	char digit = '0';
+	while (*n >= power)
+	{
+		*n -= power;
+		digit++;
+	}
+	return digit;
+}
+
+// Send a fixed-point number (val scaled by 10^places) as decimal digits, straight to the transmitter without a string buffer
+// Trailing zeros after the decimal point are dropped, and so is the decimal point if there is no fraction left
+void uart_send_fixed(int64_t val, uint8_t places)
+{
+	uint64_t n = (val < 0) ? -(uint64_t) val : (uint64_t) val; // Treat n as a positive number (as unsigned, so INT64_MIN works too)
+	if (val < 0) uart_send_byte('-');
+	
+	// Integer part, skipping leading zeros but always sending the ones digit
+	uint8_t isLeading = 1;
+	for (int8_t place = 18; place >= (int8_t) places; place--)
+	{
+		char digit = next_digit(&n, place);
+		if (digit != '0' || !isLeading || place == places)
+		{
+			uart_send_byte(digit);
+			isLeading = 0;
+		}
+	}
+	
+	// Fraction part, stopping once the rest of the digits are 0
+	if (n == 0) return;
+	uart_send_byte('.');
+	for (int8_t place = places - 1; place >= 0 && n != 0; place--) uart_send_byte(next_digit(&n, place));
+}
+
+// Send an integer as decimal digits, straight to the transmitter without a string buffer
+void uart_send_int(int64_t val)
+{
+	uart_send_fixed(val, 0);
 }
 
 // Returns the number of messages waiting to be read
 uint16_t uart_read_count(void)
 {
-	return rx_count;
+	uint16_t count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) count = rx_count; // rx_count is 2 bytes, so make sure the ISR doesn't change it mid read
+	return count;
+}
+
+// Returns the number of bytes dropped because rx_buffer was full
+uint16_t uart_dropped_count(void)
+{
+	uint16_t count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) count = rx_dropped;
+	return count;
 }
 
 // Returns the next data byte from the rx_buffer
@@ -76,8 +224,13 @@ uint8_t uart_read_byte(void)
 	uint8_t data = 0; // Initialize data to 0
 	
 	data = rx_buffer[rx_read_pos++]; // Set data to the byte of rx_buffer at rx_read_pos, increment rx_read_pos by 1 after
-	rx_count--; // Decrement rx_count by 1, because a message has been received and read
 	rx_read_pos %= RX_BUFFER_SIZE; // Wrap rx_read_pos back to 0 when it reaches RX_BUFFER_SIZE
 	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) // The ISR also changes rx_count
+	{
+		rx_count--; // Decrement rx_count by 1, because a message has been received and read
+		if (UART_FLOW_CONTROL != UART_FLOW_NONE && is_rx_stopped && rx_count <= RX_LOW_WATERMARK) flow_start();
+	}
+	
 	return data;
 }
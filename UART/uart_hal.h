@@ -1,4 +1,3 @@
-
 #ifndef UART_HAL_H_
 #define UART_HAL_H_
 
@@ -6,8 +5,33 @@
 #define RX_BUFFER_SIZE 128
 #define READ_WRITE_BUFFER_START 0
 
+// Flow control modes, select one with UART_FLOW_CONTROL
+#define UART_FLOW_NONE    0 // No flow control, bytes received while rx_buffer is full are dropped
+#define UART_FLOW_XONXOFF 1 // Software flow control, XOFF/XON are sent to the host
+#define UART_FLOW_RTSCTS  2 // Hardware flow control, RTS/CTS on GPIO pins (active low)
+
+#define UART_FLOW_CONTROL UART_FLOW_NONE
+
+// Flow control watermarks on rx_buffer
+// The host is stopped once RX_HIGH_WATERMARK bytes are waiting, the rest of the buffer absorbs bytes already on their way
+#define RX_HIGH_WATERMARK (RX_BUFFER_SIZE - 32)
+#define RX_LOW_WATERMARK  (RX_BUFFER_SIZE / 4) // The host is started again once the waiting bytes drop to this
+
+#define XON  0x11
+#define XOFF 0x13
+
+// RTS/CTS pins (UART_FLOW_RTSCTS)
+#define UART_RTS_DDR  DDRD
+#define UART_RTS_PORT PORTD
+#define UART_RTS      PORTD2 // Output, low -> host may send
+#define UART_CTS_DDR  DDRD
+#define UART_CTS_PORT PORTD
+#define UART_CTS_PIN  PIND
+#define UART_CTS      PORTD3 // Input, low -> host is ready to receive
+
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include "uart_hal.h"
@@ -15,8 +39,12 @@
 void uart_init(uint32_t baudRate, uint8_t high_speed);
 void uart_send_byte(uint8_t c);
 void uart_send_array(uint8_t *c, int length);
-void uart_send_string(char *str);
+void uart_send_string(const char *str);
+void uart_send_string_P(const char *str);
+void uart_send_int(int64_t val);
+void uart_send_fixed(int64_t val, uint8_t places);
 uint16_t uart_read_count(void);
 uint8_t uart_read_byte(void);
+uint16_t uart_dropped_count(void);
 
 #endif /* UART_HAL_H_ */
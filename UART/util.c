@@ -2,21 +2,36 @@
 
 // Puts int64_t into string array
 char* int64ToStringBuffer(char* buffer, int64_t val)
+{
+	return fixedToStringBuffer(buffer, val, 0);
+}
+
+// Puts a fixed-point number (int64_t scaled by 10^places) into string array
+// Trailing zeros after the decimal point are dropped, and so is the decimal point if there is no fraction left
+char* fixedToStringBuffer(char* buffer, int64_t val, uint8_t places)
 {
 	uint8_t digit = 0;
-	char reversed[20]; // 19 is max digits in int64_t, plus 1 for null terminator
+	char reversed[INT64_STRING_LENGTH]; // Digits, decimal point and sign in reverse order
 	char *ptr = reversed;
 	
-	int64_t n = val;
-	if (n < 0) n *= -1; // Treat n as a positive number
+	uint64_t n = (val < 0) ? -(uint64_t) val : (uint64_t) val; // Treat n as a positive number (as unsigned, so INT64_MIN works too)
+	uint8_t count = 0; // Number of digits read from n
+	uint8_t isTrailing = 1; // True while every fraction digit so far has been 0
 	
-	while (n)
+	do // Always put at least one digit before the decimal point
 	{
 		digit = n % 10;
 		n /= 10;
 		
-		*(ptr++) = digit + '0'; // Puts digits in reversed in reverse order
-	}
+		if (count >= places || digit != 0 || !isTrailing) // Skip trailing zeros of the fraction
+		{
+			*(ptr++) = digit + '0'; // Puts digits in reversed in reverse order
+			if (count < places) isTrailing = 0;
+		}
+		count++;
+		
+		if (count == places && !isTrailing) *(ptr++) = '.'; // Insert decimal point after the fraction digits
+	} while (n || count <= places);
 	if (val < 0) *(ptr++) = '-'; // Insert negative sign if needed
 	
 	int length = ptr - reversed - 1; // Determine length of number in characters
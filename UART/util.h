@@ -1,9 +1,11 @@
-
 #ifndef UTIL_H_
 #define UTIL_H_
 
 #include <stdint.h>
 
+#define INT64_STRING_LENGTH 22 // Longest int64_t string: sign, 19 digits, decimal point and null terminator
+
 char* int64ToStringBuffer(char* buffer, int64_t val);
+char* fixedToStringBuffer(char* buffer, int64_t val, uint8_t places);
 
 #endif /* UTIL_H_ */
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Prints the stack usage of every function, from the .su files gcc writes with -fstack-usage.
+
+Run by the post-build step of the firmware projects, or by hand:
+
+    python3 stack_usage.py <build output directory> [-n COUNT]
+
+Each line shows the bytes a function's own frame takes on the stack (not counting the
+functions it calls). "dynamic" frames depend on run-time values (e.g. variable length
+arrays), so their real size can be larger than shown.
+"""
+
+import argparse
+import os
+import sys
+
+
+def read_su_files(directory):
+    """Returns [(bytes, qualifier, function, location)] from every .su file under directory."""
+    frames = []
+    for root, _, files in os.walk(directory):
+        for name in files:
+            if not name.endswith(".su"):
+                continue
+            with open(os.path.join(root, name)) as f:
+                for line in f:
+                    fields = line.rstrip("\n").split("\t")
+                    if len(fields) != 3:
+                        continue
+                    # "path:line:column:function", the path may contain ':' (e.g. C:\...)
+                    path, row, _, function = fields[0].rsplit(":", 3)
+                    location = "%s:%s" % (os.path.basename(path), row)
+                    frames.append((int(fields[1]), fields[2], function, location))
+    return frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Print per-function stack usage from gcc -fstack-usage output")
+    parser.add_argument("directory", help="build output directory containing the .su files")
+    parser.add_argument("-n", "--count", type=int, default=0, help="only print the COUNT largest frames")
+    args = parser.parse_args()
+
+    frames = read_su_files(args.directory)
+    if not frames:
+        sys.exit("No .su files found in %s (is -fstack-usage set?)" % args.directory)
+
+    frames.sort(key=lambda frame: (-frame[0], frame[2]))
+    if args.count > 0:
+        frames = frames[:args.count]
+
+    width = max(len(frame[2]) for frame in frames)
+    print("Stack usage per function (bytes, own frame only):")
+    for size, qualifier, function, location in frames:
+        print("  %5d  %-*s  %-15s  %s" % (size, width, function, qualifier, location))
+
+
+if __name__ == "__main__":
+    main()